@@ -0,0 +1,211 @@
+#ifndef CONTEXT_ENCODER_HPP_
+#define CONTEXT_ENCODER_HPP_
+
+#include <fstream>
+#include <array>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstdint>
+
+using namespace std;
+
+const int16_t NO_SYMBOL = -1;
+
+// Maps raw text to symbol ids and rolling context keys for an order-k model over an alphabet.
+class ContextEncoder {
+    protected:
+        // Symbol ids are the positions of the characters in the sorted alphabet. The symbol table
+        // maps every raw byte straight to its id (case folded when ignore_case is set) or NO_SYMBOL.
+        // Contexts are packed into a rolling integer key, one base-|alphabet| digit per symbol
+        // with the oldest symbol in the most significant digit.
+        void init_symbols() {
+            sort(alphabet.begin(), alphabet.end());
+            alphabet.erase(unique(alphabet.begin(), alphabet.end()), alphabet.end());
+
+            symbol_table.fill(NO_SYMBOL);
+            for (size_t i = 0; i < alphabet.size(); i++)
+                symbol_table[static_cast<unsigned char>(alphabet[i])] = i;
+
+            if (ignore_case)
+                for (int c = 0; c < 256; c++)
+                    symbol_table[c] = symbol_table[static_cast<unsigned char>(toupper(c))];
+
+            context_radix = 1;
+            for (size_t i = 1; i < k; i++)
+                context_radix *= alphabet.size();
+        }
+
+    public:
+        size_t k;
+        string alphabet;
+        bool ignore_case;
+        array<int16_t, 256> symbol_table;
+        uint64_t context_radix;
+
+        ContextEncoder(): k(0), ignore_case(false), context_radix(1) {}
+
+        ContextEncoder(const size_t &k, const string &alphabet_, const bool &ignore_case): k(k), ignore_case(ignore_case) {
+            for (char c : alphabet_)
+                alphabet.push_back(ignore_case ? toupper(c) : c);
+
+            init_symbols();
+        }
+
+        static size_t max_order(const size_t &alphabet_size) {
+            if (alphabet_size < 2)
+                return SIZE_MAX;
+
+            size_t order = 0;
+            for (uint64_t contexts = alphabet_size; contexts <= UINT64_MAX / alphabet_size; contexts *= alphabet_size)
+                order++;
+
+            return order + 1;
+        }
+
+        size_t alphabet_size() const {
+            return alphabet.size();
+        }
+
+        bool symbol_id(const char &c, uint8_t &symbol) const {
+            int16_t id = symbol_table[static_cast<unsigned char>(c)];
+            if (id == NO_SYMBOL)
+                return false;
+
+            symbol = id;
+            return true;
+        }
+
+        char symbol(const uint8_t &id) const {
+            return alphabet[id];
+        }
+
+        vector<uint8_t> encode(const string &text) const {
+            vector<uint8_t> ids;
+            ids.reserve(text.size());
+
+            uint8_t id;
+            for (char c : text)
+                if (symbol_id(c, id))
+                    ids.push_back(id);
+
+            return ids;
+        }
+
+        uint64_t next_context(const uint64_t &context, const uint8_t &symbol) const {
+            return (context % context_radix) * alphabet.size() + symbol;
+        }
+
+        uint64_t context_key(const string &context) const {
+            uint64_t key = 0;
+            for (char c : context)
+                key = key * alphabet.size() + symbol_table[static_cast<unsigned char>(c)];
+            return key;
+        }
+
+        string context_string(uint64_t key) const {
+            string context(k, '\0');
+            for (size_t i = k; i > 0; i--) {
+                context[i - 1] = alphabet[key % alphabet.size()];
+                key /= alphabet.size();
+            }
+            return context;
+        }
+
+        // Calls f(context, symbol) for every symbol of the input that is preceded by at least k symbols.
+        template <typename F>
+        void for_each_context(ifstream &input, F f) const {
+            char c;
+            uint8_t symbol;
+            size_t length = 0;
+            uint64_t context = 0;
+
+            while (length < k && input.get(c)) {
+                if (symbol_id(c, symbol)) {
+                    context = next_context(context, symbol);
+                    length++;
+                }
+            }
+
+            while (input.get(c)) {
+                if (symbol_id(c, symbol)) {
+                    f(context, symbol);
+                    context = next_context(context, symbol);
+                }
+            }
+        }
+
+        template <typename F>
+        void for_each_context(const string &text, F f) const {
+            uint8_t symbol;
+            size_t i = 0;
+            size_t length = 0;
+            uint64_t context = 0;
+
+            while (length < k && i < text.size()) {
+                if (symbol_id(text[i], symbol)) {
+                    context = next_context(context, symbol);
+                    length++;
+                }
+                i++;
+            }
+
+            while (i < text.size()) {
+                if (symbol_id(text[i], symbol)) {
+                    f(context, symbol);
+                    context = next_context(context, symbol);
+                }
+                i++;
+            }
+        }
+
+        // Same as above for text already mapped to symbol ids with encode.
+        template <typename F>
+        void for_each_context(const uint8_t *symbols, const size_t &size, F f) const {
+            uint64_t context = 0;
+
+            for (size_t i = 0; i < size; i++) {
+                if (i >= k)
+                    f(context, symbols[i]);
+                context = next_context(context, symbols[i]);
+            }
+        }
+
+        template <typename F>
+        void for_each_context(const vector<uint8_t> &symbols, F f) const {
+            for_each_context(symbols.data(), symbols.size(), f);
+        }
+
+        // Calls f(i, context, symbol) for every symbol of the input that is preceded by at least
+        // orders[i] symbols, for each of the ascending orders (none above k). The text is mapped to
+        // symbol ids and rolled into order-k keys once; the order-orders[i] context is the low
+        // orders[i] digits of that key. Orders are visited one after the other to keep each
+        // model's table hot in cache.
+        template <typename F>
+        void for_each_context(const string &text, const vector<size_t> &orders, F f) const {
+            vector<uint8_t> symbols = encode(text);
+            for_each_context(symbols.data(), symbols.size(), orders, f);
+        }
+
+        template <typename F>
+        void for_each_context(const uint8_t *symbols, const size_t &size, const vector<size_t> &orders, F f) const {
+            vector<uint64_t> contexts(size);
+
+            uint64_t context = 0;
+            for (size_t j = 0; j < size; j++) {
+                contexts[j] = context;
+                context = next_context(context, symbols[j]);
+            }
+
+            for (size_t i = 0; i < orders.size(); i++) {
+                uint64_t radix = 1;
+                for (size_t j = 0; j < orders[i]; j++)
+                    radix *= alphabet.size();
+
+                for (size_t j = orders[i]; j < size; j++)
+                    f(i, contexts[j] % radix, symbols[j]);
+            }
+        }
+};
+
+#endif // CONTEXT_ENCODER_HPP_
@@ -0,0 +1,83 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <iomanip>
+#include <chrono>
+#include <unistd.h>
+
+#include "packed_corpus.hpp"
+
+using namespace std;
+using namespace chrono;
+
+void print_usage(const char *argv0) {
+    cout << "Usage: " << argv0 << " [-a alphabet] [-i] [-o output_file] input_file+" << endl;
+    cout << endl;
+    cout << "Pack the rows of CSV files into a binary corpus of symbol ids that trainer and evaluator read without parsing." << endl;
+    cout << "It can only be used with the alphabet and case handling it was packed with." << endl;
+    cout << endl;
+    cout << "Options:" << endl;
+    cout << "  -a alphabet\t\t\tAlphabet of the models. (default: abc...ABC...012...)" << endl;
+    cout << "  -i\t\t\t\tIgnore case, as the models trained with -i. (default: false)" << endl;
+    cout << "  -o output_file\t\tOutput file for the packed corpus. (default: corpus.pack)" << endl;
+    cout << "  -h\t\t\t\tDisplay this help message" << endl;
+    cout << endl;
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+
+    string alphabet = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    bool ignore_case = false;
+    string output_file = "corpus.pack";
+
+    while ((opt = getopt(argc, argv, "a:io:h")) != -1) {
+        switch (opt) {
+            case 'a':
+                alphabet = optarg;
+                if (alphabet.empty()) {
+                    cerr << "Alphabet cannot be empty" << endl;
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'i':
+                ignore_case = true;
+                break;
+            case 'o':
+                output_file = optarg;
+                break;
+            case 'h':
+                printf("Help\n");
+                print_usage(argv[0]);
+                exit(EXIT_SUCCESS);
+            case '?':
+                printf("Unknown option: %c\n", optopt);
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            case ':':
+                printf("Missing argument for option: %c\n", optopt);
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            default:
+                printf("Error parsing arguments\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (optind >= argc)
+    {
+        cerr << "Input file not provided" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    vector<string> input_files(argv + optind, argv + argc);
+
+    auto start_packing = high_resolution_clock::now();
+
+    PackedCorpus::write(input_files, "text", "label", ContextEncoder(1, alphabet, ignore_case), output_file);
+
+    auto end_packing = high_resolution_clock::now();
+
+    cout << "Packing time: " << fixed << setprecision(6) << duration_cast<duration<double>>(end_packing - start_packing).count() << "s" << endl;
+}
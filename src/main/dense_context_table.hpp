@@ -0,0 +1,67 @@
+#ifndef DENSE_CONTEXT_TABLE_HPP_
+#define DENSE_CONTEXT_TABLE_HPP_
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+using namespace std;
+
+// Count table addressed directly by context key: the counts of context c live in
+// counts[c * alphabet_size .. (c + 1) * alphabet_size) and its total in totals[c].
+class DenseContextTable {
+    public:
+        size_t alphabet_size;
+        vector<uint32_t> counts;
+        vector<uint32_t> totals;
+
+        DenseContextTable(): alphabet_size(0) {}
+
+        void resize(const uint64_t &contexts, const size_t &alphabet_size_) {
+            alphabet_size = alphabet_size_;
+            counts.assign(contexts * alphabet_size, 0);
+            totals.assign(contexts, 0);
+        }
+
+        uint32_t *events(const uint64_t &context) {
+            return &counts[context * alphabet_size];
+        }
+
+        const uint32_t *events(const uint64_t &context) const {
+            return &counts[context * alphabet_size];
+        }
+
+        uint32_t &count(const uint64_t &context, const uint8_t &symbol) {
+            return counts[context * alphabet_size + symbol];
+        }
+
+        uint32_t count(const uint64_t &context, const uint8_t &symbol) const {
+            return counts[context * alphabet_size + symbol];
+        }
+
+        uint32_t &total(const uint64_t &context) {
+            return totals[context];
+        }
+
+        uint32_t total(const uint64_t &context) const {
+            return totals[context];
+        }
+
+        size_t contexts() const {
+            return totals.size();
+        }
+
+        size_t size() const {
+            size_t used = 0;
+            for (uint32_t total : totals)
+                used += total != 0;
+            return used;
+        }
+
+        void clear() {
+            fill(counts.begin(), counts.end(), 0);
+            fill(totals.begin(), totals.end(), 0);
+        }
+};
+
+#endif // DENSE_CONTEXT_TABLE_HPP_
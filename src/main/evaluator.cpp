@@ -3,6 +3,8 @@
 #include <string>
 #include <iomanip>
 #include <chrono>
+#include <sstream>
+#include <algorithm>
 
 #include "finite_context_model_evaluator.hpp"
 
@@ -10,13 +12,19 @@ using namespace std;
 using namespace chrono;
 
 void print_usage(const char *argv0) {
-    cout << "Usage: " << argv0 << " [-m model_file+] input_file+" << endl;
+    cout << "Usage: " << argv0 << " [-m model_file+ | -l ratio_file] input_file+" << endl;
     cout << endl;
-    cout << "Run the Evaluator on the input file." << endl;
+    cout << "Run the Evaluator on the input file, a CSV file or a corpus packed by corpus_pack with the alphabet and case handling" << endl;
+    cout << "of the models. (packed corpora cannot be combined with -f, -l or -j)" << endl;
     cout << endl;
     cout << "Options:" << endl;
     cout << "  -m model_file+\t\tModel file(s) for the Evaluator." << endl;
     cout << "  -u\t\t\t\tUpdate the counts of the model while evaluating." << endl;
+    cout << "  -f\t\t\t\tFuse the models into one multi-label table scored in a single pass. (cannot be combined with -u)" << endl;
+    cout << "  -l ratio_file\t\t\tLog ratio table exported from two models, used instead of the model files. Bits are reported relative to the second label." << endl;
+    cout << "  -s smoothing_factors\t\tComma-separated smoothing factors replacing those of the models, all evaluated in one pass with a" << endl;
+    cout << "\t\t\t\tconfusion matrix each. (cannot be combined with -u, -f, -l or -j)" << endl;
+    cout << "  -j threads\t\t\tNumber of threads scoring the rows of the input files. (default: 1, cannot be combined with -u)" << endl;
     cout << "  -h\t\t\t\tDisplay this help message" << endl;
     cout << endl;
 }
@@ -26,8 +34,12 @@ int main(int argc, char *argv[]) {
 
     vector<string> model_files;
     bool update = false;
+    bool fuse = false;
+    string ratio_file;
+    int threads = 1;
+    vector<float> smoothing_factors;
 
-    while ((opt = getopt(argc, argv, "m:uh")) != -1) {
+    while ((opt = getopt(argc, argv, "m:ufl:j:s:h")) != -1) {
         switch (opt) {
             case 'm':
                 model_files.push_back(optarg);
@@ -35,6 +47,22 @@ int main(int argc, char *argv[]) {
             case 'u':
                 update = true;
                 break;
+            case 'f':
+                fuse = true;
+                break;
+            case 'l':
+                ratio_file = optarg;
+                break;
+            case 's': {
+                stringstream factors(optarg);
+                string factor;
+                while (getline(factors, factor, ','))
+                    smoothing_factors.push_back(stof(factor));
+                break;
+            }
+            case 'j':
+                threads = stoi(optarg);
+                break;
             case 'h':
                 printf("Help\n");
                 print_usage(argv[0]);
@@ -54,12 +82,42 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    if (model_files.size() < 2)
+    if (ratio_file.empty() && model_files.size() < 2)
     {
         cerr << "At least two model files must be provided" << endl;
         exit(EXIT_FAILURE);
     }
 
+    if (fuse && update)
+    {
+        cerr << "Fused models cannot be updated" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    if (threads < 1)
+    {
+        cerr << "The number of threads must be at least 1" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    if (threads > 1 && update)
+    {
+        cerr << "Models cannot be updated while evaluating with several threads" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    if (!smoothing_factors.empty() && (update || fuse || !ratio_file.empty() || threads > 1))
+    {
+        cerr << "A smoothing factor sweep cannot be combined with -u, -f, -l or -j" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    if (!ratio_file.empty() && (update || fuse || !model_files.empty()))
+    {
+        cerr << "A log ratio table cannot be combined with model files, -u or -f" << endl;
+        exit(EXIT_FAILURE);
+    }
+
     if (optind >= argc)
     {
         cerr << "Input file not provided" << endl;
@@ -68,9 +126,38 @@ int main(int argc, char *argv[]) {
 
     vector<string> input_files(argv + optind, argv + argc);
 
+    bool packed = any_of(input_files.begin(), input_files.end(), PackedCorpus::is_packed);
+
+    if (packed && (fuse || !ratio_file.empty() || threads > 1))
+    {
+        cerr << "Packed corpora cannot be combined with -f, -l or -j" << endl;
+        exit(EXIT_FAILURE);
+    }
+
     auto start_loading = high_resolution_clock::now();
 
-    FiniteContextModelEvaluator evaluator(model_files);
+    FiniteContextModelEvaluator evaluator = ratio_file.empty() ? FiniteContextModelEvaluator(model_files) : FiniteContextModelEvaluator(LogRatioTable(ratio_file));
+
+    if (fuse && !evaluator.fuse())
+    {
+        cerr << "Models must share the same order, alphabet and case handling to be fused" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    for (const string& input_file: input_files) {
+        if (!PackedCorpus::is_packed(input_file))
+            continue;
+
+        PackedCorpus corpus(input_file);
+
+        for (const auto& [label, model]: evaluator.models) {
+            if (!corpus.compatible(model))
+            {
+                cerr << input_file << " was not packed with the alphabet and case handling of the " << label << " model" << endl;
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
 
     auto end_loading = high_resolution_clock::now();
 
@@ -78,8 +165,39 @@ int main(int argc, char *argv[]) {
 
     auto start_evaluating = high_resolution_clock::now();
 
-    for (const string& input_file: input_files)
-        evaluator.evaluate(input_file, "text", "label", update);
+    if (!smoothing_factors.empty())
+    {
+        vector<FiniteContextModelEvaluator> results;
+
+        for (const string& input_file: input_files) {
+            if (PackedCorpus::is_packed(input_file))
+                evaluator.sweep(PackedCorpus(input_file), smoothing_factors, results);
+            else
+                evaluator.sweep(input_file, "text", "label", smoothing_factors, results);
+        }
+
+        auto end_evaluating = high_resolution_clock::now();
+
+        for (size_t s = 0; s < smoothing_factors.size(); s++) {
+            cout << "Smoothing factor: " << smoothing_factors[s] << endl;
+            results[s].summary();
+            cout << endl;
+        }
+
+        cout << "Evaluation time: " << fixed << setprecision(6) << duration_cast<duration<double>>(end_evaluating - start_evaluating).count() << "s" << endl;
+        cout << "Total time: " << fixed << setprecision(6) << duration_cast<duration<double>>(end_evaluating - start_loading).count() << "s" << endl;
+
+        return 0;
+    }
+
+    for (const string& input_file: input_files) {
+        if (PackedCorpus::is_packed(input_file))
+            evaluator.evaluate(PackedCorpus(input_file), update);
+        else if (threads > 1)
+            evaluator.evaluate(input_file, "text", "label", static_cast<size_t>(threads));
+        else
+            evaluator.evaluate(input_file, "text", "label", update);
+    }
 
     auto end_evaluating = high_resolution_clock::now();
 
@@ -0,0 +1,46 @@
+#ifndef EVENT_COUNT_HPP_
+#define EVENT_COUNT_HPP_
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+using namespace std;
+
+// Lets threads that poll lock-free structures sleep once spinning stops paying off. A waiter takes
+// a key with prepare, checks its condition once more and only then waits for the key to change;
+// every notify after prepare changes it, so a wakeup between the check and the wait is never
+// lost. notify only takes the lock when someone is waiting.
+class EventCount {
+    private:
+        atomic<uint64_t> epoch;
+        atomic<uint32_t> waiters;
+        mutex lock;
+        condition_variable changed;
+
+    public:
+        EventCount(): epoch(0), waiters(0) {}
+
+        uint64_t prepare() const {
+            return epoch.load();
+        }
+
+        void wait(const uint64_t &key) {
+            unique_lock<mutex> guard(lock);
+            waiters++;
+            changed.wait(guard, [this, &key]() { return epoch.load() != key; });
+            waiters--;
+        }
+
+        void notify() {
+            epoch.fetch_add(1);
+            if (waiters.load() == 0)
+                return;
+
+            lock_guard<mutex> guard(lock);
+            changed.notify_all();
+        }
+};
+
+#endif // EVENT_COUNT_HPP_
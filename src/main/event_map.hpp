@@ -0,0 +1,139 @@
+#ifndef EVENT_MAP_HPP_
+#define EVENT_MAP_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+using namespace std;
+
+// Event counts of a single context. Up to INLINE_CAPACITY events are kept inline, sorted by
+// symbol; past that the map is promoted to a heap array indexed directly by symbol id.
+struct EventMap {
+    static constexpr uint8_t INLINE_CAPACITY = 4;
+    static constexpr uint8_t DENSE = UINT8_MAX;
+
+    union {
+        uint32_t counts[INLINE_CAPACITY];
+        uint32_t *dense;
+    };
+    uint32_t total;
+    uint8_t size;
+    uint8_t symbols[INLINE_CAPACITY];
+    uint16_t width;
+
+    EventMap(): total(0), size(0), width(0) {}
+
+    EventMap(const EventMap &other): total(other.total), size(other.size), width(other.width) {
+        memcpy(symbols, other.symbols, sizeof(symbols));
+
+        if (is_dense()) {
+            dense = new uint32_t[width];
+            copy(other.dense, other.dense + width, dense);
+        } else {
+            memcpy(counts, other.counts, sizeof(counts));
+        }
+    }
+
+    EventMap(EventMap &&other) noexcept: total(other.total), size(other.size), width(other.width) {
+        memcpy(symbols, other.symbols, sizeof(symbols));
+        memcpy(counts, other.counts, sizeof(counts));
+        other.size = 0;
+    }
+
+    EventMap &operator=(EventMap other) noexcept {
+        swap(other);
+        return *this;
+    }
+
+    ~EventMap() {
+        if (is_dense())
+            delete[] dense;
+    }
+
+    void swap(EventMap &other) noexcept {
+        uint32_t counts_[INLINE_CAPACITY];
+        memcpy(counts_, counts, sizeof(counts));
+        memcpy(counts, other.counts, sizeof(counts));
+        memcpy(other.counts, counts_, sizeof(counts));
+
+        std::swap(total, other.total);
+        std::swap(size, other.size);
+        std::swap(symbols, other.symbols);
+        std::swap(width, other.width);
+    }
+
+    bool is_dense() const {
+        return size == DENSE;
+    }
+
+    uint32_t count(const uint8_t &symbol) const {
+        if (is_dense())
+            return dense[symbol];
+
+        for (uint8_t i = 0; i < size && symbols[i] <= symbol; i++)
+            if (symbols[i] == symbol)
+                return counts[i];
+
+        return 0;
+    }
+
+    // Returns the counter of symbol, inserting it (and promoting to the dense layout once the
+    // inline slots are exhausted) if it is not yet present.
+    uint32_t &event(const uint8_t &symbol, const size_t &alphabet_size) {
+        if (is_dense())
+            return dense[symbol];
+
+        uint8_t i = 0;
+        while (i < size && symbols[i] < symbol)
+            i++;
+
+        if (i < size && symbols[i] == symbol)
+            return counts[i];
+
+        if (size == INLINE_CAPACITY) {
+            promote(alphabet_size);
+            return dense[symbol];
+        }
+
+        for (uint8_t j = size; j > i; j--) {
+            symbols[j] = symbols[j - 1];
+            counts[j] = counts[j - 1];
+        }
+
+        symbols[i] = symbol;
+        counts[i] = 0;
+        size++;
+
+        return counts[i];
+    }
+
+    // Calls f(symbol, count) for every stored counter, including zero counters of dense maps.
+    template <typename F>
+    void for_each(F f) {
+        if (is_dense()) {
+            for (uint16_t symbol = 0; symbol < width; symbol++)
+                f(static_cast<uint8_t>(symbol), dense[symbol]);
+        } else {
+            for (uint8_t i = 0; i < size; i++)
+                f(symbols[i], counts[i]);
+        }
+    }
+
+    template <typename F>
+    void for_each(F f) const {
+        const_cast<EventMap*>(this)->for_each([&f](const uint8_t &symbol, const uint32_t &count) { f(symbol, count); });
+    }
+
+    void promote(const size_t &alphabet_size) {
+        uint32_t *events = new uint32_t[alphabet_size]();
+        for (uint8_t i = 0; i < size; i++)
+            events[symbols[i]] = counts[i];
+
+        dense = events;
+        width = alphabet_size;
+        size = DENSE;
+    }
+};
+
+#endif // EVENT_MAP_HPP_
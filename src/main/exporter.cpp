@@ -0,0 +1,181 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <unistd.h>
+
+#include "log_ratio_table.hpp"
+#include "csv.hpp"
+
+using namespace std;
+using namespace chrono;
+using namespace csv;
+
+struct ScoreComparison {
+    string name;
+    size_t correct = 0;
+    size_t agreements = 0;
+    double total_error = 0;
+    double max_error = 0;
+
+    void add(const double &score, const double &reference, const string &label, const string (&labels)[2]) {
+        correct += (score < 0 ? labels[0] : labels[1]) == label;
+        agreements += (score < 0) == (reference < 0);
+
+        double error = fabs(score - reference);
+        total_error += error;
+        max_error = max(max_error, error);
+    }
+};
+
+// Ratio of the whole text computed in double precision straight from the model counts.
+double exact_ratio(const FiniteContextModel &first, const FiniteContextModel &second, const string &text) {
+    double total = 0;
+    first.for_each_context(text, [&](const uint64_t &context, const uint8_t &symbol) {
+        ContextEntry counts[2] = {first.find(context), second.find(context)};
+        total += LogRatioTable::bits(first.count(counts[0], symbol), first.count(counts[0]), first.smoothing_factor, first.alphabet.size())
+            - LogRatioTable::bits(second.count(counts[1], symbol), second.count(counts[1]), second.smoothing_factor, second.alphabet.size());
+    });
+    return total;
+}
+
+// Scores every text of a CSV file with the models, the float table and the int16 table, and reports
+// how far each strays from the exact ratio and how often its decision differs.
+void compare(const FiniteContextModel &first, const FiniteContextModel &second, const LogRatioTable &ratios, const LogRatioTable &quantized, const string &input_file) {
+    ScoreComparison comparisons[3];
+    comparisons[0].name = "Models (float)";
+    comparisons[1].name = "Ratio table (float)";
+    comparisons[2].name = "Ratio table (int16)";
+
+    size_t texts = 0;
+    size_t exact_correct = 0;
+
+    CSVReader reader(input_file);
+
+    for (CSVRow &row : reader) {
+        string text = row["text"].get<>();
+        string label = row["label"].get<>();
+
+        double reference = exact_ratio(first, second, text);
+        exact_correct += (reference < 0 ? ratios.labels[0] : ratios.labels[1]) == label;
+
+        comparisons[0].add(first.estimate_bits(text) - second.estimate_bits(text), reference, label, ratios.labels);
+        comparisons[1].add(ratios.estimate_ratio(text), reference, label, ratios.labels);
+        comparisons[2].add(quantized.estimate_ratio(text), reference, label, ratios.labels);
+        texts++;
+    }
+
+    if (texts == 0)
+        return;
+
+    cout << endl;
+    cout << "Comparison on " << input_file << " (" << texts << " texts, int16 ratios with " << static_cast<int>(quantized.fraction_bits) << " fraction bits):" << endl;
+    cout << "Exact (double) accuracy: " << fixed << setprecision(6) << static_cast<double>(exact_correct) / texts << endl;
+
+    for (const ScoreComparison &comparison : comparisons) {
+        cout << endl;
+        cout << comparison.name << ":" << endl;
+        cout << "  Accuracy: " << fixed << setprecision(6) << static_cast<double>(comparison.correct) / texts << endl;
+        cout << "  Agreement with exact: " << fixed << setprecision(6) << static_cast<double>(comparison.agreements) / texts << endl;
+        cout << "  Mean absolute error: " << fixed << setprecision(6) << comparison.total_error / texts << " bits" << endl;
+        cout << "  Max absolute error: " << fixed << setprecision(6) << comparison.max_error << " bits" << endl;
+    }
+}
+
+void print_usage(const char *argv0) {
+    cout << "Usage: " << argv0 << " -m model_file -m model_file [-o output_file] [-q] [-c input_file]" << endl;
+    cout << endl;
+    cout << "Export two trained models as a table of precomputed log-likelihood ratios for binary detection." << endl;
+    cout << endl;
+    cout << "Options:" << endl;
+    cout << "  -m model_file\t\t\tModel file of a label. Exactly two must be given." << endl;
+    cout << "  -o output_file\t\tOutput file for the log ratio table. (default: ratios.bin)" << endl;
+    cout << "  -q\t\t\t\tStore the ratios as int16 fixed-point values, summed with SIMD instructions when scoring." << endl;
+    cout << "  -c input_file\t\t\tCompare the accuracy of the float and int16 tables against exact scores on a labelled CSV file." << endl;
+    cout << "  -h\t\t\t\tDisplay this help message" << endl;
+    cout << endl;
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+
+    vector<string> model_files;
+    string output_file = "ratios.bin";
+    bool quantize = false;
+    string comparison_file;
+
+    while ((opt = getopt(argc, argv, "m:o:qc:h")) != -1) {
+        switch (opt) {
+            case 'm':
+                model_files.push_back(optarg);
+                break;
+            case 'o':
+                output_file = optarg;
+                break;
+            case 'q':
+                quantize = true;
+                break;
+            case 'c':
+                comparison_file = optarg;
+                break;
+            case 'h':
+                printf("Help\n");
+                print_usage(argv[0]);
+                exit(EXIT_SUCCESS);
+            case '?':
+                printf("Unknown option: %c\n", optopt);
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            case ':':
+                printf("Missing argument for option: %c\n", optopt);
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            default:
+                printf("Error parsing arguments\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (model_files.size() != 2)
+    {
+        cerr << "Exactly two model files must be provided" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    auto start_loading = high_resolution_clock::now();
+
+    FiniteContextModel first(model_files[0]);
+    FiniteContextModel second(model_files[1]);
+
+    auto end_loading = high_resolution_clock::now();
+
+    cout << "Loading time: " << fixed << setprecision(6) << duration_cast<duration<double>>(end_loading - start_loading).count() << "s" << endl;
+
+    if (!FiniteContextModel::compatible(first, second))
+    {
+        cerr << "Models must share the same order, alphabet and case handling to be exported" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    auto start_exporting = high_resolution_clock::now();
+
+    LogRatioTable ratios(first, second);
+
+    LogRatioTable quantized;
+    if (quantize || !comparison_file.empty()) {
+        quantized = ratios;
+        quantized.quantize();
+    }
+
+    (quantize ? quantized : ratios).save(output_file);
+
+    auto end_exporting = high_resolution_clock::now();
+
+    cout << "Exporting time: " << fixed << setprecision(6) << duration_cast<duration<double>>(end_exporting - start_exporting).count() << "s" << endl;
+
+    if (!comparison_file.empty())
+        compare(first, second, ratios, quantized, comparison_file);
+}
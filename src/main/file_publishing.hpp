@@ -0,0 +1,64 @@
+#ifndef FILE_PUBLISHING_HPP_
+#define FILE_PUBLISHING_HPP_
+
+#include <iostream>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Paths starting with this prefix name POSIX shared memory objects. On Linux these are the files
+// of the /dev/shm tmpfs, so every process mapping a model published there shares the same
+// physical pages, which are never written back to or evicted to disk.
+const string SHARED_MEMORY_PREFIX = "shm:";
+const string SHARED_MEMORY_DIRECTORY = "/dev/shm/";
+
+// File backing a path, resolving shared memory object names.
+inline string resolve_path(const string &path) {
+    if (path.compare(0, SHARED_MEMORY_PREFIX.size(), SHARED_MEMORY_PREFIX) == 0)
+        return SHARED_MEMORY_DIRECTORY + path.substr(SHARED_MEMORY_PREFIX.size());
+    return path;
+}
+
+// Creates an empty file next to file, on the same file system so that it can be renamed over it,
+// with the permissions a new file would get. Returns its name.
+inline string create_temporary(const string &file) {
+    string temporary_file = file + ".XXXXXX";
+    int descriptor = mkstemp(&temporary_file[0]);
+
+    if (descriptor < 0) {
+        cerr << "Error: cannot write " << file << ": " << strerror(errno) << "." << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    mode_t mask = umask(0);
+    umask(mask);
+    fchmod(descriptor, 0666 & ~mask);
+    close(descriptor);
+
+    return temporary_file;
+}
+
+// Flushes a complete temporary file to storage and atomically replaces file with it. Existing
+// mappings of file keep the previous inode; later opens see the new contents. Files are written
+// this way so that readers never see a partial file and a file can be saved over its own source.
+inline void publish(const string &temporary_file, const string &file) {
+    int descriptor = open(temporary_file.c_str(), O_RDONLY);
+    bool synced = descriptor >= 0 && fsync(descriptor) == 0;
+    if (descriptor >= 0)
+        close(descriptor);
+
+    if (!synced || rename(temporary_file.c_str(), file.c_str()) != 0) {
+        cerr << "Error: cannot write " << file << ": " << strerror(errno) << "." << endl;
+        unlink(temporary_file.c_str());
+        exit(EXIT_FAILURE);
+    }
+}
+
+#endif // FILE_PUBLISHING_HPP_
@@ -3,180 +3,651 @@
 
 #include <iostream>
 #include <fstream>
-#include <unordered_set>
 #include <unordered_map>
+#include <array>
+#include <utility>
 #include <vector>
 #include <string>
 #include <numeric>
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
 
-#include "circular_buffer.hpp"
+#include "context_encoder.hpp"
+#include "event_map.hpp"
+#include "dense_context_table.hpp"
+#include "flat_context_table.hpp"
+#include "mapped_context_table.hpp"
+#include "varint.hpp"
+#include "file_publishing.hpp"
 
 using namespace std;
 
-struct EventMap {
-    unordered_map<char, uint32_t> events;
+enum class ContextStorage : uint8_t {
+    HASH,
+    DENSE,
+    FLAT,
+    MAPPED
+};
+
+// On-disk layouts save can write. MAPPED files are loaded as read-only MAPPED storage. COMPACT
+// files hold the contexts sorted and front-coded, with symbol ids and varint counts.
+enum class ModelFormat : uint8_t {
+    STANDARD,
+    MAPPED,
+    COMPACT
+};
+
+const char MODEL_FILE_MAGIC[8] = {'F', 'C', 'M', 'O', 'D', 'E', 'L', '\0'};
+const uint8_t MODEL_FILE_VERSION = 2;
+
+// Upper bound on the number of cells (contexts * |alphabet|) of a dense count table.
+const uint64_t DENSE_MAX_CELLS = 1ULL << 28;
+
+// Counts of one context resolved with a single table lookup. Hash and flat models point at the
+// context's EventMap (null when the context was never seen), dense models at its row of counts
+// and mapped models at its sorted symbols and counts.
+struct ContextEntry {
+    const EventMap *events;
+    const uint32_t *dense;
     uint32_t total;
+    const uint8_t *symbols = nullptr;
+    const uint32_t *counts = nullptr;
+    uint32_t size = 0;
+
+    uint32_t count(const uint8_t &symbol) const {
+        if (dense != nullptr)
+            return dense[symbol];
+
+        if (symbols != nullptr) {
+            const uint8_t *it = lower_bound(symbols, symbols + size, symbol);
+            return it != symbols + size && *it == symbol ? counts[it - symbols] : 0;
+        }
+
+        return events == nullptr ? 0 : events->count(symbol);
+    }
 };
 
-class FiniteContextModel {
+class FiniteContextModel : public ContextEncoder {
 
     private:
-        virtual void increment(EventMap &counts, const char &event) {
+        virtual void increment(EventMap &counts, const uint8_t &symbol) {
             if (counts.total == UINT32_MAX) {
                 cerr << "Warning: Event count has reached maximum size (UINT32_MAX). Scaling down counts." << endl;
 
-                for (auto &pair : counts.events)
-                    pair.second /= scaling_factor;
-
+                counts.for_each([this](const uint8_t &, uint32_t &count) { count /= scaling_factor; });
                 counts.total /= scaling_factor;
             }
 
-            counts.events[event]++;
+            counts.event(symbol, alphabet.size())++;
             counts.total++;
         }
 
+        void increment(DenseContextTable &counts, const uint64_t &context, const uint8_t &symbol) {
+            uint32_t &total = counts.total(context);
+
+            if (total == UINT32_MAX) {
+                cerr << "Warning: Event count has reached maximum size (UINT32_MAX). Scaling down counts." << endl;
+
+                uint32_t *events = counts.events(context);
+                for (size_t i = 0; i < counts.alphabet_size; i++)
+                    events[i] /= scaling_factor;
+
+                total /= scaling_factor;
+            }
+
+            counts.count(context, symbol)++;
+            total++;
+        }
+
+        // Adds the counts of a context from another model, scaling the existing counts down first
+        // whenever the total would overflow, as increment does.
+        void add(EventMap &counts, const vector<pair<uint8_t, uint32_t>> &events, const uint32_t &total) {
+            while (scaling_factor > 1 && counts.total > UINT32_MAX - total) {
+                cerr << "Warning: Event count has reached maximum size (UINT32_MAX). Scaling down counts." << endl;
+
+                counts.for_each([this](const uint8_t &, uint32_t &count) { count /= scaling_factor; });
+                counts.total /= scaling_factor;
+            }
+
+            for (const auto &[symbol, count] : events)
+                counts.event(symbol, alphabet.size()) += count;
+            counts.total += total;
+        }
+
+        void add(DenseContextTable &counts, const uint64_t &context, const vector<pair<uint8_t, uint32_t>> &events, const uint32_t &total) {
+            uint32_t &context_total = counts.total(context);
+
+            while (scaling_factor > 1 && context_total > UINT32_MAX - total) {
+                cerr << "Warning: Event count has reached maximum size (UINT32_MAX). Scaling down counts." << endl;
+
+                uint32_t *context_events = counts.events(context);
+                for (size_t i = 0; i < counts.alphabet_size; i++)
+                    context_events[i] /= scaling_factor;
+
+                context_total /= scaling_factor;
+            }
+
+            for (const auto &[symbol, count] : events)
+                counts.count(context, symbol) += count;
+            context_total += total;
+        }
+
+        void store(const uint64_t &context, const vector<pair<uint8_t, uint32_t>> &events, const uint32_t &total) {
+            if (storage == ContextStorage::DENSE) {
+                for (const auto &[symbol, count] : events)
+                    dense_counts.count(context, symbol) = count;
+                dense_counts.total(context) = total;
+                return;
+            }
+
+            EventMap &counts = storage == ContextStorage::FLAT ? flat_counts[context] : context_counts[context];
+            for (const auto &[symbol, count] : events)
+                counts.event(symbol, alphabet.size()) = count;
+            counts.total = total;
+        }
+
+        void write_context(ofstream &output, const uint64_t &context, const vector<pair<uint8_t, uint32_t>> &events, const uint32_t &total) {
+            string context_str = context_string(context);
+
+            size_t context_size = context_str.size();
+            output.write((char*)&context_size, sizeof(context_size));
+            output.write(context_str.c_str(), context_str.size());
+
+            size_t events_size = events.size();
+            output.write((char*)&events_size, sizeof(events_size));
+
+            for (const auto &[symbol, count] : events) {
+                output.write(&alphabet[symbol], sizeof(char));
+                output.write((char*)&count, sizeof(count));
+            }
+
+            output.write((char*)&total, sizeof(total));
+        }
+
+        // Contexts in key order, which is the lexicographic order of their symbol ids. Each starts
+        // with the number of leading symbols shared with the previous context and the remaining
+        // symbol ids, followed by the varint number of events, the (symbol id, varint count) of
+        // each event and the zigzag varint difference between the total and the sum of the counts.
+        void write_compact(ofstream &output) const {
+            struct Context {
+                uint64_t key;
+                uint32_t total;
+                size_t offset;
+                size_t size;
+            };
+
+            // The events handed out by for_each_counts are kept, sorted by symbol, so that contexts
+            // are not looked up again once sorted.
+            vector<Context> sorted_contexts;
+            vector<pair<uint8_t, uint32_t>> all_events;
+            sorted_contexts.reserve(contexts());
+
+            for_each_counts([&sorted_contexts, &all_events](const uint64_t &context, const vector<pair<uint8_t, uint32_t>> &events, const uint32_t &total) {
+                sorted_contexts.push_back({context, total, all_events.size(), events.size()});
+                all_events.insert(all_events.end(), events.begin(), events.end());
+                sort(all_events.end() - events.size(), all_events.end());
+            });
+
+            sort(sorted_contexts.begin(), sorted_contexts.end(), [](const Context &first, const Context &second) {
+                return first.key < second.key;
+            });
+
+            string buffer;
+            put_varint(buffer, sorted_contexts.size());
+
+            vector<uint8_t> previous(k, 0);
+            vector<uint8_t> digits(k);
+
+            for (const Context &entry : sorted_contexts) {
+                uint64_t context = entry.key;
+                for (size_t i = k; i-- > 0; context /= alphabet.size())
+                    digits[i] = context % alphabet.size();
+
+                size_t prefix = 0;
+                while (prefix < k && digits[prefix] == previous[prefix])
+                    prefix++;
+
+                buffer.push_back(static_cast<char>(prefix));
+                buffer.append(digits.begin() + prefix, digits.end());
+                previous.swap(digits);
+
+                uint64_t sum = 0;
+                put_varint(buffer, entry.size);
+                for (size_t i = entry.offset; i < entry.offset + entry.size; i++) {
+                    buffer.push_back(static_cast<char>(all_events[i].first));
+                    put_varint(buffer, all_events[i].second);
+                    sum += all_events[i].second;
+                }
+
+                put_varint(buffer, zigzag(static_cast<int64_t>(entry.total) - static_cast<int64_t>(sum)));
+            }
+
+            output.write(buffer.data(), buffer.size());
+        }
+
+        void read_compact(ifstream &input) {
+            string buffer((istreambuf_iterator<char>(input)), istreambuf_iterator<char>());
+            const char *position = buffer.data();
+            const char *end = position + buffer.size();
+
+            size_t contexts_size = get_varint(position, end);
+            reserve(contexts_size);
+
+            vector<uint8_t> digits(k, 0);
+            vector<pair<uint8_t, uint32_t>> events;
+
+            for (size_t i = 0; i < contexts_size && position != end; i++) {
+                size_t prefix = static_cast<uint8_t>(*position++);
+                for (size_t j = prefix; j < k && position != end; j++)
+                    digits[j] = static_cast<uint8_t>(*position++);
+
+                uint64_t context = 0;
+                for (uint8_t digit : digits)
+                    context = context * alphabet.size() + digit;
+
+                events.resize(get_varint(position, end));
+                int64_t sum = 0;
+                for (auto &[symbol, count] : events) {
+                    symbol = position != end ? static_cast<uint8_t>(*position++) : 0;
+                    count = get_varint(position, end);
+                    sum += count;
+                }
+
+                store(context, events, sum + unzigzag(get_varint(position, end)));
+            }
+        }
+
+        void require_writable() const {
+            if (storage == ContextStorage::MAPPED) {
+                cerr << "Error: memory-mapped models are read-only." << endl;
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        template <typename Table, typename F>
+        void for_each_counts(const Table &table, F f) const {
+            vector<pair<uint8_t, uint32_t>> events;
+
+            for (const auto &[context, counts] : table) {
+                events.clear();
+                counts.for_each([&events](const uint8_t &symbol, const uint32_t &count) {
+                    if (count != 0)
+                        events.emplace_back(symbol, count);
+                });
+                f(context, events, counts.total);
+            }
+        }
+
+        void write_model(ofstream &output, const ModelFormat &format) {
+            output.write(MODEL_FILE_MAGIC, sizeof(MODEL_FILE_MAGIC));
+            output.write((char*)&MODEL_FILE_VERSION, sizeof(MODEL_FILE_VERSION));
+
+            size_t id_size = id.size();
+            output.write((char*)&id_size, sizeof(id_size));
+            output.write(id.c_str(), id.size());
+
+            save_parameters(output);
+
+            ContextStorage saved_storage = storage == ContextStorage::MAPPED ? ContextStorage::HASH : storage;
+            if (format == ModelFormat::MAPPED)
+                saved_storage = ContextStorage::MAPPED;
+            output.write((char*)&saved_storage, sizeof(saved_storage));
+            output.write((char*)&format, sizeof(format));
+
+            size_t alphabet_size = alphabet.size();
+            output.write((char*)&alphabet_size, sizeof(alphabet_size));
+
+            for (char c : alphabet) output.write(&c, sizeof(c));
+
+            if (format == ModelFormat::MAPPED) {
+                MappedContextTable::write(output, contexts(), [this](auto g) { for_each_counts(g); });
+                return;
+            }
+
+            if (format == ModelFormat::COMPACT) {
+                write_compact(output);
+                return;
+            }
+
+            size_t context_counts_size = contexts();
+            output.write((char*)&context_counts_size, sizeof(context_counts_size));
+
+            for_each_counts([this, &output](const uint64_t &context, const vector<pair<uint8_t, uint32_t>> &events, const uint32_t &total) {
+                write_context(output, context, events, total);
+            });
+        }
+
+    protected:
+        virtual void load_parameters(ifstream &input) {
+            input.read((char*)&k, sizeof(k));
+            input.read((char*)&smoothing_factor, sizeof(smoothing_factor));
+            input.read((char*)&ignore_case, sizeof(ignore_case));
+            input.read((char*)&scaling_factor, sizeof(scaling_factor));
+        }
+
+        virtual void save_parameters(ofstream &output) {
+            output.write((char*)&k, sizeof(k));
+            output.write((char*)&smoothing_factor, sizeof(smoothing_factor));
+            output.write((char*)&ignore_case, sizeof(ignore_case));
+            output.write((char*)&scaling_factor, sizeof(scaling_factor));
+        }
+
+        void init_storage() {
+            if (storage == ContextStorage::DENSE)
+                dense_counts.resize(context_radix * alphabet.size(), alphabet.size());
+        }
+
     public:
-        size_t k;
         float smoothing_factor;
-        unordered_set<char> alphabet;
-        bool ignore_case;
         uint8_t scaling_factor;
         string id;
-        unordered_map<string, EventMap> context_counts;
+        ContextStorage storage;
+        unordered_map<uint64_t, EventMap> context_counts;
+        DenseContextTable dense_counts;
+        FlatContextTable<EventMap> flat_counts;
+        MappedContextTable mapped_counts;
+
+        FiniteContextModel(): smoothing_factor(0), storage(ContextStorage::HASH) {}
 
-        FiniteContextModel(): k(0), smoothing_factor(0), ignore_case(false) {}
-        
-        FiniteContextModel(const size_t &k, const float &smoothing_factor, const string &alphabet_, const bool &ignore_case, const uint8_t scaling_factor, const string &id = ""): k(k), smoothing_factor(smoothing_factor), ignore_case(ignore_case), scaling_factor(scaling_factor), id(id) {
-            for (char c : alphabet_)
-                alphabet.insert(ignore_case ? toupper(c) : c);
+        FiniteContextModel(const size_t &k, const float &smoothing_factor, const string &alphabet_, const bool &ignore_case, const uint8_t scaling_factor, const string &id = "", const ContextStorage &storage = ContextStorage::HASH): ContextEncoder(k, alphabet_, ignore_case), smoothing_factor(smoothing_factor), scaling_factor(scaling_factor), id(id), storage(storage) {
+            init_storage();
         }
 
         FiniteContextModel(const string& input_file) {
             load(input_file);
         }
 
+        FiniteContextModel(const FiniteContextModel &) = default;
+        FiniteContextModel(FiniteContextModel &&) = default;
+        FiniteContextModel &operator=(const FiniteContextModel &) = default;
+        FiniteContextModel &operator=(FiniteContextModel &&) = default;
+        virtual ~FiniteContextModel() = default;
+
+        static size_t max_dense_order(const size_t &alphabet_size) {
+            if (alphabet_size < 2)
+                return SIZE_MAX;
+
+            size_t order = 0;
+            for (uint64_t cells = alphabet_size * alphabet_size; cells <= DENSE_MAX_CELLS; cells *= alphabet_size)
+                order++;
+
+            return order;
+        }
+
         void update(ifstream &input) {
-            char c;
-            circular_buffer<char> buffer(k);
+            for_each_context(input, [this](const uint64_t &context, const uint8_t &symbol) {
+                increment(context, symbol);
+            });
+        }
 
-            while (buffer.size() < k && input.get(c)) {
-                if (is_valid_char(c)) 
-                    buffer.put(c);
-            }
+        void update(const string &input) {
+            for_each_context(input, [this](const uint64_t &context, const uint8_t &symbol) {
+                increment(context, symbol);
+            });
+        }
 
-            while (input.get(c)) {
-                if (is_valid_char(c)) {
-                    increment(context_counts[buffer], c);
-                    buffer.put(c);
-                }
-            }
+        void update(const uint8_t *symbols, const size_t &size) {
+            for_each_context(symbols, size, [this](const uint64_t &context, const uint8_t &symbol) {
+                increment(context, symbol);
+            });
+        }
+
+        void update(const vector<uint8_t> &symbols) {
+            update(symbols.data(), symbols.size());
+        }
+
+        void increment(const uint64_t &context, const uint8_t &symbol) {
+            require_writable();
+
+            if (storage == ContextStorage::DENSE)
+                increment(dense_counts, context, symbol);
+            else if (storage == ContextStorage::FLAT)
+                increment(flat_counts[context], symbol);
+            else
+                increment(context_counts[context], symbol);
         }
 
-        void update(string &input) {
-            size_t i = 0;
-            circular_buffer<char> buffer(k);
+        // Models can be merged when their contexts and symbols are encoded the same way.
+        static bool compatible(const FiniteContextModel &first, const FiniteContextModel &second) {
+            return first.k == second.k && first.alphabet == second.alphabet && first.ignore_case == second.ignore_case;
+        }
 
-            while (buffer.size() < k && i < input.size()) {
-                if (is_valid_char(input[i]))
-                    buffer.put(input[i]);
-                i++;
+        // Adds every count of other, which must share k, alphabet and case handling with this model.
+        // Counts are summed, so merging models trained on disjoint parts of a dataset gives the
+        // counts of training on all of it.
+        void merge(const FiniteContextModel &other) {
+            require_writable();
+
+            other.for_each_counts([this](const uint64_t &context, const vector<pair<uint8_t, uint32_t>> &events, const uint32_t &total) {
+                if (storage == ContextStorage::DENSE)
+                    add(dense_counts, context, events, total);
+                else if (storage == ContextStorage::FLAT)
+                    add(flat_counts[context], events, total);
+                else
+                    add(context_counts[context], events, total);
+            });
+        }
+
+        ContextEntry find(const uint64_t &context) const {
+            if (storage == ContextStorage::DENSE)
+                return {nullptr, dense_counts.events(context), dense_counts.total(context)};
+
+            if (storage == ContextStorage::MAPPED) {
+                const MappedContextTable::Slot *slot = mapped_counts.find(context);
+                if (slot == nullptr)
+                    return {nullptr, nullptr, 0};
+                return {nullptr, nullptr, slot->total, mapped_counts.symbols + slot->offset, mapped_counts.counts + slot->offset, slot->size};
             }
 
-            while (i < input.size()) {
-                if (is_valid_char(input[i])) {
-                    increment(context_counts[buffer], input[i]);
-                    buffer.put(input[i]);
-                }
-                i++;
+            const EventMap *counts = nullptr;
+
+            if (storage == ContextStorage::FLAT) {
+                counts = flat_counts.find(context);
+            } else {
+                auto it = context_counts.find(context);
+                if (it != context_counts.end())
+                    counts = &it->second;
             }
+
+            return {counts, nullptr, counts == nullptr ? 0 : counts->total};
+        }
+
+        virtual uint32_t count(const ContextEntry &entry, const uint8_t &symbol) const {
+            return entry.count(symbol);
+        }
+
+        virtual uint32_t count(const ContextEntry &entry) const {
+            return entry.total;
         }
 
-        virtual uint32_t count(const string &context, const char &event) {
-            return context_counts[context].events[event];
+        uint32_t count(const uint64_t &context, const uint8_t &symbol) const {
+            return count(find(context), symbol);
         }
 
-        virtual uint32_t count(const string &context) {
-            return context_counts[context].total;
+        uint32_t count(const uint64_t &context) const {
+            return count(find(context));
         }
 
-        uint32_t count() {
-            return accumulate(context_counts.begin(), context_counts.end(), 0, 
-                [](uint32_t sum, const pair<string, EventMap> &context_count) {
+        uint32_t count() const {
+            if (storage == ContextStorage::DENSE)
+                return accumulate(dense_counts.totals.begin(), dense_counts.totals.end(), 0);
+
+            if (storage == ContextStorage::MAPPED) {
+                uint32_t sum = 0;
+                mapped_counts.for_each([&sum](const MappedContextTable::Slot &slot) { sum += slot.total; });
+                return sum;
+            }
+
+            if (storage == ContextStorage::FLAT)
+                return accumulate(flat_counts.begin(), flat_counts.end(), 0,
+                    [](uint32_t sum, const FlatContextTable<EventMap>::Slot &slot) {
+                        return sum + slot.value.total;
+                    });
+
+            return accumulate(context_counts.begin(), context_counts.end(), 0,
+                [](uint32_t sum, const pair<uint64_t, EventMap> &context_count) {
                     return sum + context_count.second.total;
                 });
         }
 
-        float probability(const string &context, const char &event) {
-            return (count(context, event) + smoothing_factor) / (count(context) + alphabet.size() * smoothing_factor);
+        float probability(const ContextEntry &entry, const uint8_t &symbol) const {
+            return (count(entry, symbol) + smoothing_factor) / (count(entry) + alphabet.size() * smoothing_factor);
         }
 
-        float estimate_bits(const string &context, const char &event) {
-            return -log2(probability(context, event));
+        float probability(const uint64_t &context, const uint8_t &symbol) const {
+            return probability(find(context), symbol);
         }
 
-        float estimate_bits(ifstream &input, const bool &update = false) {
+        float estimate_bits(const uint64_t &context, const uint8_t &symbol) const {
+            return -log2(probability(find(context), symbol));
+        }
+
+        // Read-only scoring: contexts are only looked up, never inserted, so a model can be shared
+        // between threads while it is being queried.
+        float estimate_bits(ifstream &input) const {
             float bits = 0;
+            for_each_context(input, [this, &bits](const uint64_t &context, const uint8_t &symbol) {
+                bits += estimate_bits(context, symbol);
+            });
+            return bits;
+        }
 
-            char c;
-            circular_buffer<char> buffer(k);
+        float estimate_bits(const string &text) const {
+            float bits = 0;
+            for_each_context(text, [this, &bits](const uint64_t &context, const uint8_t &symbol) {
+                bits += estimate_bits(context, symbol);
+            });
+            return bits;
+        }
 
-            while (buffer.size() < k && input.get(c)) {
-                if (is_valid_char(c)) 
-                    buffer.put(c);
-            }
+        // Same as above for text already mapped to symbol ids.
+        float estimate_bits(const uint8_t *symbols, const size_t &size) const {
+            float bits = 0;
+            for_each_context(symbols, size, [this, &bits](const uint64_t &context, const uint8_t &symbol) {
+                bits += estimate_bits(context, symbol);
+            });
+            return bits;
+        }
 
-            while (input.get(c)) {
-                if (is_valid_char(c)) {
-                    bits += estimate_bits(buffer, c);
-                    if (update) increment(context_counts[buffer], c);
-                    buffer.put(c);
-                }
-            }
+        // Bits of the text under each of the smoothing factors instead of the model's own, with
+        // every context looked up once for all of them. Counts do not depend on the factor.
+        vector<float> estimate_bits(const string &text, const vector<float> &smoothing_factors) const {
+            return estimate_bits(encode(text), smoothing_factors);
+        }
+
+        vector<float> estimate_bits(const vector<uint8_t> &symbols, const vector<float> &smoothing_factors) const {
+            return estimate_bits(symbols.data(), symbols.size(), smoothing_factors);
+        }
 
+        vector<float> estimate_bits(const uint8_t *symbols, const size_t &size, const vector<float> &smoothing_factors) const {
+            vector<float> bits(smoothing_factors.size(), 0);
+            for_each_context(symbols, size, [this, &bits, &smoothing_factors](const uint64_t &context, const uint8_t &symbol) {
+                ContextEntry entry = find(context);
+                uint32_t event_count = count(entry, symbol);
+                uint32_t total = count(entry);
+
+                for (size_t i = 0; i < smoothing_factors.size(); i++)
+                    bits[i] += -log2((event_count + smoothing_factors[i]) / (total + alphabet.size() * smoothing_factors[i]));
+            });
+            return bits;
+        }
+
+        // Same as above with the counts of held_out, a model of the same order and alphabet trained
+        // on part of the data of this one, taken away. This scores documents against a model that
+        // was not trained on them without building it. Counts rescaled after an overflow are not
+        // exactly separable and are clamped at zero.
+        vector<float> estimate_bits(const vector<uint8_t> &symbols, const vector<float> &smoothing_factors, const FiniteContextModel &held_out) const {
+            vector<float> bits(smoothing_factors.size(), 0);
+            for_each_context(symbols, [this, &bits, &smoothing_factors, &held_out](const uint64_t &context, const uint8_t &symbol) {
+                ContextEntry entry = find(context);
+                ContextEntry held_out_entry = held_out.find(context);
+
+                uint32_t event_count = count(entry, symbol);
+                uint32_t held_out_event_count = held_out.count(held_out_entry, symbol);
+                event_count = event_count > held_out_event_count ? event_count - held_out_event_count : 0;
+
+                uint32_t total = count(entry);
+                uint32_t held_out_total = held_out.count(held_out_entry);
+                total = total > held_out_total ? total - held_out_total : 0;
+
+                for (size_t i = 0; i < smoothing_factors.size(); i++)
+                    bits[i] += -log2((event_count + smoothing_factors[i]) / (total + alphabet.size() * smoothing_factors[i]));
+            });
             return bits;
         }
-        
-        float estimate_bits(const string &text, const bool &update = false) {
+
+        float estimate_bits(ifstream &input, const bool &update) {
+            if (!update)
+                return as_const(*this).estimate_bits(input);
+
             float bits = 0;
+            for_each_context(input, [this, &bits](const uint64_t &context, const uint8_t &symbol) {
+                bits += estimate_bits(context, symbol);
+                increment(context, symbol);
+            });
+            return bits;
+        }
 
-            char c;
-            size_t i = 0;
-            circular_buffer<char> buffer(k);
+        float estimate_bits(const string &text, const bool &update) {
+            if (!update)
+                return as_const(*this).estimate_bits(text);
 
-            while (buffer.size() < k && i < text.size()) {
-                c = text[i];
-                if (is_valid_char(c)) 
-                    buffer.put(c);
-                i++;
-            }
+            float bits = 0;
+            for_each_context(text, [this, &bits](const uint64_t &context, const uint8_t &symbol) {
+                bits += estimate_bits(context, symbol);
+                increment(context, symbol);
+            });
+            return bits;
+        }
 
-            while (i < text.size()) {
-                c = text[i];
-                if (is_valid_char(c)) {
-                    bits += estimate_bits(buffer, c);
-                    if (update) increment(context_counts[buffer], c);
-                    buffer.put(c);
-                }
-                i++;
-            }
+        float estimate_bits(const uint8_t *symbols, const size_t &size, const bool &update) {
+            if (!update)
+                return as_const(*this).estimate_bits(symbols, size);
 
+            float bits = 0;
+            for_each_context(symbols, size, [this, &bits](const uint64_t &context, const uint8_t &symbol) {
+                bits += estimate_bits(context, symbol);
+                increment(context, symbol);
+            });
             return bits;
         }
 
-        virtual void load(const string& input_file) {
+        void load(const string& input_path) {
+            string input_file = resolve_path(input_path);
             ifstream input(input_file, ios::binary);
 
+            char magic[sizeof(MODEL_FILE_MAGIC)];
+            if (!input.read(magic, sizeof(magic))) {
+                cerr << "Error: cannot read " << input_file << "." << endl;
+                exit(EXIT_FAILURE);
+            }
+
+            // Files written before the header was introduced start directly with the id size.
             size_t id_size;
-            input.read((char*)&id_size, sizeof(id_size));
+            uint8_t version = 0;
+            bool versioned = memcmp(magic, MODEL_FILE_MAGIC, sizeof(magic)) == 0;
+
+            if (versioned) {
+                input.read((char*)&version, sizeof(version));
+                input.read((char*)&id_size, sizeof(id_size));
+            } else {
+                memcpy(&id_size, magic, sizeof(id_size));
+            }
 
             id.resize(id_size);
             input.read(&id[0], id_size);
 
-            input.read((char*)&k, sizeof(k));
-            input.read((char*)&smoothing_factor, sizeof(smoothing_factor));
-            input.read((char*)&ignore_case, sizeof(ignore_case));
-            input.read((char*)&scaling_factor, sizeof(scaling_factor));
+            load_parameters(input);
+
+            storage = ContextStorage::HASH;
+            if (versioned)
+                input.read((char*)&storage, sizeof(storage));
+
+            ModelFormat format = storage == ContextStorage::MAPPED ? ModelFormat::MAPPED : ModelFormat::STANDARD;
+            if (versioned && version >= 2)
+                input.read((char*)&format, sizeof(format));
 
             size_t alphabet_size;
             input.read((char*)&alphabet_size, sizeof(alphabet_size));
@@ -184,12 +655,34 @@ class FiniteContextModel {
             for (size_t i = 0; i < alphabet_size; i++) {
                 char c;
                 input.read(&c, sizeof(c));
-                alphabet.insert(c);
+                alphabet.push_back(c);
+            }
+
+            if (!input) {
+                cerr << "Error: cannot read " << input_file << "." << endl;
+                exit(EXIT_FAILURE);
+            }
+
+            init_symbols();
+            init_storage();
+
+            if (storage == ContextStorage::MAPPED) {
+                mapped_counts.open(input_file, MappedContextTable::block_offset(input.tellg()));
+                input.close();
+                return;
+            }
+
+            if (format == ModelFormat::COMPACT) {
+                read_compact(input);
+                input.close();
+                return;
             }
 
             size_t context_counts_size;
             input.read((char*)&context_counts_size, sizeof(context_counts_size));
 
+            reserve(context_counts_size);
+
             for (size_t i = 0; i < context_counts_size; i++) {
                 size_t context_size;
                 input.read((char*)&context_size, sizeof(context_size));
@@ -201,69 +694,121 @@ class FiniteContextModel {
                 size_t events_size;
                 input.read((char*)&events_size, sizeof(events_size));
 
-                EventMap counts;
-                for (size_t j = 0; j < events_size; j++) {
+                vector<pair<uint8_t, uint32_t>> events(events_size);
+                for (auto &[symbol, count] : events) {
                     char event;
-                    uint32_t count;
                     input.read(&event, sizeof(event));
                     input.read((char*)&count, sizeof(count));
-                    counts.events[event] = count;
+                    symbol = symbol_table[static_cast<unsigned char>(event)];
                 }
 
-                input.read((char*)&counts.total, sizeof(counts.total));
-                context_counts[context] = counts;
+                uint32_t total;
+                input.read((char*)&total, sizeof(total));
+                store(context_key(context), events, total);
             }
-            
+
             input.close();
         }
 
-        virtual void save(const string &output_file) {
-            ofstream output(output_file, ios::binary);
+        // The model is written to a temporary file next to the target, which is then renamed over
+        // it. Processes still mapping the previous file, including this one when it saves over its
+        // own input, keep reading it, and new readers see the old or the new model, never a part.
+        void save(const string &output_path, const ModelFormat &format = ModelFormat::STANDARD) {
+            string output_file = resolve_path(output_path);
+            string temporary_file = create_temporary(output_file);
 
-            size_t id_size = id.size();
-            output.write((char*)&id_size, sizeof(id_size));
-            output.write(id.c_str(), id.size());
+            ofstream output(temporary_file, ios::binary);
+            write_model(output, format);
+            output.close();
 
-            output.write((char*)&k, sizeof(k));
-            output.write((char*)&smoothing_factor, sizeof(smoothing_factor));
-            output.write((char*)&ignore_case, sizeof(ignore_case));
-            output.write((char*)&scaling_factor, sizeof(scaling_factor));
+            if (output.fail()) {
+                unlink(temporary_file.c_str());
+                cerr << "Error: cannot write " << output_file << "." << endl;
+                exit(EXIT_FAILURE);
+            }
 
-            size_t alphabet_size = alphabet.size();
-            output.write((char*)&alphabet_size, sizeof(alphabet_size));
+            publish(temporary_file, output_file);
+        }
 
-            for (char c : alphabet) output.write(&c, sizeof(c));
+        void reserve(const size_t &contexts) {
+            if (storage == ContextStorage::HASH)
+                context_counts.reserve(contexts);
+            else if (storage == ContextStorage::FLAT)
+                flat_counts.reserve(contexts);
+        }
 
-            size_t context_counts_size = context_counts.size();
-            output.write((char*)&context_counts_size, sizeof(context_counts_size));
+        // Bytes taken by the counts in the standard format, without the header.
+        size_t saved_size() const {
+            size_t size = sizeof(size_t);
+            for_each_counts([this, &size](const uint64_t &, const vector<pair<uint8_t, uint32_t>> &events, const uint32_t &) {
+                size += sizeof(size_t) + k + sizeof(size_t) + events.size() * (sizeof(char) + sizeof(uint32_t)) + sizeof(uint32_t);
+            });
+            return size;
+        }
 
-            for (const auto &context_count : context_counts) {
-                size_t context_size = context_count.first.size();
-                output.write((char*)&context_size, sizeof(context_size));
-                output.write(context_count.first.c_str(), context_count.first.size());
+        size_t contexts() const {
+            if (storage == ContextStorage::DENSE)
+                return dense_counts.size();
+            if (storage == ContextStorage::FLAT)
+                return flat_counts.size();
+            if (storage == ContextStorage::MAPPED)
+                return mapped_counts.size();
+            return context_counts.size();
+        }
 
-                size_t events_size = context_count.second.events.size();
-                output.write((char*)&events_size, sizeof(events_size));
+        // Calls f(context, events, total) for every stored context, with events holding the
+        // (symbol, count) pairs of its non-zero counters in symbol order for dense models.
+        template <typename F>
+        void for_each_counts(F f) const {
+            if (storage == ContextStorage::DENSE) {
+                vector<pair<uint8_t, uint32_t>> events;
 
-                for (const auto &event : context_count.second.events) {
-                    output.write(&event.first, sizeof(event.first));
-                    output.write((char*)&event.second, sizeof(event.second));
-                }
+                for (uint64_t context = 0; context < dense_counts.contexts(); context++) {
+                    if (dense_counts.total(context) == 0)
+                        continue;
 
-                output.write((char*)&context_count.second.total, sizeof(context_count.second.total));
+                    events.clear();
+                    for (size_t symbol = 0; symbol < alphabet.size(); symbol++)
+                        if (dense_counts.count(context, symbol) != 0)
+                            events.emplace_back(symbol, dense_counts.count(context, symbol));
+
+                    f(context, events, dense_counts.total(context));
+                }
+            } else if (storage == ContextStorage::FLAT) {
+                for_each_counts(flat_counts, f);
+            } else if (storage == ContextStorage::MAPPED) {
+                vector<pair<uint8_t, uint32_t>> events;
+
+                mapped_counts.for_each([this, &events, &f](const MappedContextTable::Slot &slot) {
+                    events.clear();
+                    for (uint32_t i = slot.offset; i < slot.offset + slot.size; i++)
+                        events.emplace_back(mapped_counts.symbols[i], mapped_counts.counts[i]);
+                    f(slot.key, events, slot.total);
+                });
+            } else {
+                for_each_counts(context_counts, f);
             }
-            
-            output.close();
         }
 
-        bool is_valid_char(char &c) {
-            if (ignore_case) 
-                c = toupper(c);
-            return alphabet.find(c) != alphabet.end();
+        // Copies the counts of a memory-mapped model into a hash table so that it can be updated.
+        void unmap() {
+            if (storage != ContextStorage::MAPPED)
+                return;
+
+            context_counts.reserve(mapped_counts.size());
+            for_each_counts([this](const uint64_t &context, const vector<pair<uint8_t, uint32_t>> &events, const uint32_t &total) {
+                store(context, events, total);
+            });
+
+            storage = ContextStorage::HASH;
+            mapped_counts = MappedContextTable();
         }
 
         void reset() {
             context_counts.clear();
+            dense_counts.clear();
+            flat_counts.clear();
+            mapped_counts = MappedContextTable();
         }
 };
 
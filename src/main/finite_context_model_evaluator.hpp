@@ -8,22 +8,92 @@
 #include <string>
 #include <limits>
 #include <numeric>
+#include <algorithm>
+#include <iterator>
+#include <thread>
 
 #include "finite_context_model.hpp"
+#include "fused_finite_context_model.hpp"
+#include "log_ratio_table.hpp"
+#include "work_queue.hpp"
+#include "packed_corpus.hpp"
 #include "csv.hpp"
 
 using namespace std;
 using namespace csv;
 
+// Rows buffered per worker thread between the CSV reader and the scoring workers.
+const size_t ROWS_PER_THREAD = 64;
+
 struct Prediction {
     string label;
     unordered_map<string, double> bits;
 };
 
 class FiniteContextModelEvaluator {
+    private:
+        static string read(ifstream& input) {
+            input.seekg(0, ios::end);
+            streamoff size = input.tellg();
+
+            if (size < 0) {
+                input.clear();
+                return string(istreambuf_iterator<char>(input), istreambuf_iterator<char>());
+            }
+
+            string text(size, '\0');
+            input.seekg(0, ios::beg);
+            input.read(&text[0], size);
+            text.resize(input.gcount());
+
+            return text;
+        }
+
+        Prediction select(const vector<string>& labels, const vector<float>& label_bits) const {
+            float min_bits = numeric_limits<float>::max();
+
+            string predicted_label;
+            unordered_map<string, double> predicted_bits;
+
+            for (size_t i = 0; i < labels.size(); i++) {
+                predicted_bits[labels[i]] = label_bits[i];
+
+                if (label_bits[i] < min_bits) {
+                    min_bits = label_bits[i];
+                    predicted_label = labels[i];
+                }
+            }
+
+            return {predicted_label, predicted_bits};
+        }
+
+        // Bits are reported relative to the second label, which is all a log ratio table knows.
+        Prediction select(const double& ratio) const {
+            return {ratio < 0 ? ratios.labels[0] : ratios.labels[1], {{ratios.labels[0], ratio}, {ratios.labels[1], 0}}};
+        }
+
+        // Adds the prediction of a document of the given label under each smoothing factor of a
+        // sweep to results, model_bits[i][s] being its bits for labels[i] and factor s.
+        void tally(const vector<string>& labels, const vector<vector<float>>& model_bits, const string& label, vector<FiniteContextModelEvaluator>& results) const {
+            vector<float> label_bits(labels.size());
+
+            for (size_t s = 0; s < results.size(); s++) {
+                for (size_t i = 0; i < labels.size(); i++)
+                    label_bits[i] = model_bits[i][s];
+
+                Prediction prediction = select(labels, label_bits);
+                results[s].confusion_matrix[label][prediction.label]++;
+                results[s].bits += prediction.bits[prediction.label];
+            }
+        }
+
     public:
         double bits = 0;
         unordered_map<string, FiniteContextModel> models;
+        FusedFiniteContextModel fused;
+        bool is_fused = false;
+        LogRatioTable ratios;
+        bool is_ratio = false;
         unordered_map<string, unordered_map<string, uint32_t>> confusion_matrix;
 
         FiniteContextModelEvaluator(const vector<string>& model_files) {
@@ -38,7 +108,22 @@ class FiniteContextModelEvaluator {
                 models.emplace(label, FiniteContextModel(model_file));
         }
 
-        FiniteContextModelEvaluator(const unordered_map<string, FiniteContextModel>& models): models(models) {}
+        FiniteContextModelEvaluator(unordered_map<string, FiniteContextModel> models): models(move(models)) {}
+
+        FiniteContextModelEvaluator(const LogRatioTable& ratios): ratios(ratios), is_ratio(true) {}
+
+        // Replaces the per-label models by a single fused table. Fused models are read-only, so
+        // predictions no longer update the counts afterwards.
+        bool fuse() {
+            if (!FusedFiniteContextModel::compatible(models))
+                return false;
+
+            fused = FusedFiniteContextModel(models);
+            models.clear();
+            is_fused = true;
+
+            return true;
+        }
 
         void evaluate(const string& text, const string& label, const bool& update = false) {
             string predicted_label = predict(text, update).label;
@@ -57,32 +142,108 @@ class FiniteContextModelEvaluator {
             }
         }
 
-        Prediction predict(ifstream& input_file, const bool& update = false) {
-            float min_bits = numeric_limits<float>::max();
+        // Evaluates rows packed with corpus_pack, which must match the alphabet and case handling of
+        // the models. Fused models and log ratio tables score text, so they are not supported.
+        void evaluate(const PackedCorpus& corpus, const bool& update = false) {
+            corpus.for_each([this, &update](const string& label, const uint8_t* symbols, const size_t& size) {
+                string predicted_label = predict(symbols, size, update).label;
+                confusion_matrix[label][predicted_label]++;
+            });
+        }
 
-            string predicted_label;
-            unordered_map<string, double> predicted_bits;
+        // Parallel version of evaluate without updates: the calling thread reads the rows and
+        // threads workers score them against the shared read-only models. Each worker keeps its
+        // own confusion matrix and row bits, which are merged at the end, with the bits summed in
+        // row order so that the totals match the sequential evaluation exactly.
+        void evaluate(const string& input_file, const string& text_column, const string& label_column, const size_t& threads) {
+            struct Row {
+                size_t index;
+                string text;
+                string label;
+            };
+
+            struct Partial {
+                unordered_map<string, unordered_map<string, uint32_t>> confusion_matrix;
+                vector<pair<size_t, double>> bits;
+            };
+
+            WorkQueue<Row> rows(threads * ROWS_PER_THREAD);
+            vector<Partial> partials(threads);
+            vector<thread> workers;
+
+            for (Partial& partial: partials)
+                workers.emplace_back([this, &rows, &partial]() {
+                    Row row;
+                    while (rows.pop(row)) {
+                        Prediction prediction = score(row.text);
+                        partial.confusion_matrix[row.label][prediction.label]++;
+
+                        if (!is_ratio)
+                            partial.bits.emplace_back(row.index, prediction.bits[prediction.label]);
+                    }
+                });
 
-            for (auto& [label, model]: models) {
-                float bits = model.estimate_bits(input_file, update);
-                predicted_bits[label] = bits;
+            CSVReader reader(input_file);
+            size_t index = 0;
 
-                input_file.clear();
-                input_file.seekg(0, ios::beg);
+            for (CSVRow& row: reader)
+                rows.push({index++, row[text_column].get<>(), row[label_column].get<>()});
 
-                if (bits < min_bits) {
-                    min_bits = bits;
-                    predicted_label = label;
-                }
-                
+            rows.close();
+
+            for (thread& worker: workers)
+                worker.join();
+
+            vector<pair<size_t, double>> row_bits;
+
+            for (Partial& partial: partials) {
+                for (const auto& [label, predictions]: partial.confusion_matrix)
+                    for (const auto& [predicted_label, count]: predictions)
+                        confusion_matrix[label][predicted_label] += count;
+
+                row_bits.insert(row_bits.end(), partial.bits.begin(), partial.bits.end());
             }
 
-            bits += min_bits;
+            sort(row_bits.begin(), row_bits.end());
 
-            return {predicted_label, predicted_bits};
+            for (const auto& [_, row]: row_bits)
+                bits += row;
+        }
+
+        // The document is read into memory once and every model scores that buffer, instead of
+        // reading the file again for each model.
+        Prediction predict(ifstream& input_file, const bool& update = false) {
+            return predict(read(input_file), update);
+        }
+
+        // Scores text against every label without updating the counts or the running bit total,
+        // so it may be called from several threads at once.
+        Prediction score(const string& text) const {
+            if (is_fused)
+                return select(fused.labels, fused.estimate_bits(text));
+
+            if (is_ratio)
+                return select(ratios.estimate_ratio(text));
+
+            vector<string> labels;
+            vector<float> label_bits;
+
+            for (const auto& [label, model]: models) {
+                labels.push_back(label);
+                label_bits.push_back(model.estimate_bits(text));
+            }
+
+            return select(labels, label_bits);
         }
 
         Prediction predict(const string& text, const bool& update = false) {
+            if (!update || is_fused || is_ratio) {
+                Prediction prediction = score(text);
+                if (!is_ratio)
+                    bits += prediction.bits[prediction.label];
+                return prediction;
+            }
+
             float min_bits = numeric_limits<float>::max();
 
             string predicted_label;
@@ -103,6 +264,103 @@ class FiniteContextModelEvaluator {
             return {predicted_label, predicted_bits};
         }
 
+        // Same as above for text already mapped to the symbol ids of the models, which score it.
+        Prediction predict(const uint8_t* symbols, const size_t& size, const bool& update = false) {
+            vector<string> labels;
+            vector<float> label_bits;
+
+            for (auto& [label, model]: models) {
+                labels.push_back(label);
+                label_bits.push_back(model.estimate_bits(symbols, size, update));
+            }
+
+            Prediction prediction = select(labels, label_bits);
+            bits += prediction.bits[prediction.label];
+
+            return prediction;
+        }
+
+        // Evaluates the input once for all the smoothing factors, which replace those of the models,
+        // reusing every context lookup across them. results[s] accumulates the confusion matrix and
+        // bits of smoothing_factors[s], so that several input files can be swept into it.
+        void sweep(const string& input_file, const string& text_column, const string& label_column, const vector<float>& smoothing_factors, vector<FiniteContextModelEvaluator>& results) const {
+            if (results.size() != smoothing_factors.size())
+                results.assign(smoothing_factors.size(), FiniteContextModelEvaluator(unordered_map<string, FiniteContextModel>()));
+
+            vector<string> labels;
+            for (const auto& [label, _]: models) labels.push_back(label);
+
+            vector<vector<float>> model_bits(models.size());
+
+            CSVReader reader(input_file);
+
+            for (CSVRow& row: reader) {
+                string text = row[text_column].get<>();
+                string label = row[label_column].get<>();
+
+                for (size_t i = 0; i < labels.size(); i++)
+                    model_bits[i] = models.at(labels[i]).estimate_bits(text, smoothing_factors);
+
+                tally(labels, model_bits, label, results);
+            }
+        }
+
+        void sweep(const PackedCorpus& corpus, const vector<float>& smoothing_factors, vector<FiniteContextModelEvaluator>& results) const {
+            if (results.size() != smoothing_factors.size())
+                results.assign(smoothing_factors.size(), FiniteContextModelEvaluator(unordered_map<string, FiniteContextModel>()));
+
+            vector<string> labels;
+            for (const auto& [label, _]: models) labels.push_back(label);
+
+            vector<vector<float>> model_bits(models.size());
+
+            corpus.for_each([this, &labels, &model_bits, &smoothing_factors, &results](const string& label, const uint8_t* symbols, const size_t& size) {
+                for (size_t i = 0; i < labels.size(); i++)
+                    model_bits[i] = models.at(labels[i]).estimate_bits(symbols, size, smoothing_factors);
+
+                tally(labels, model_bits, label, results);
+            });
+        }
+
+        // Same as above for documents already mapped to the symbol ids of the models, labelled by
+        // the matching entries of document_labels.
+        void sweep(const vector<vector<uint8_t>>& documents, const vector<string>& document_labels, const vector<float>& smoothing_factors, vector<FiniteContextModelEvaluator>& results) const {
+            if (results.size() != smoothing_factors.size())
+                results.assign(smoothing_factors.size(), FiniteContextModelEvaluator(unordered_map<string, FiniteContextModel>()));
+
+            vector<string> labels;
+            for (const auto& [label, _]: models) labels.push_back(label);
+
+            vector<vector<float>> model_bits(models.size());
+
+            for (size_t d = 0; d < documents.size(); d++) {
+                for (size_t i = 0; i < labels.size(); i++)
+                    model_bits[i] = models.at(labels[i]).estimate_bits(documents[d], smoothing_factors);
+
+                tally(labels, model_bits, document_labels[d], results);
+            }
+        }
+
+        // Cross-validation sweep: each document is scored against the counts of the models minus
+        // those of fold_models[folds[d]], the models of the same labels trained only on the
+        // documents of its fold, so that no document is scored by counts it contributed to.
+        void sweep(const vector<vector<uint8_t>>& documents, const vector<string>& document_labels, const vector<size_t>& folds, const vector<unordered_map<string, FiniteContextModel>>& fold_models, const vector<float>& smoothing_factors, vector<FiniteContextModelEvaluator>& results) const {
+            if (results.size() != smoothing_factors.size())
+                results.assign(smoothing_factors.size(), FiniteContextModelEvaluator(unordered_map<string, FiniteContextModel>()));
+
+            vector<string> labels;
+            for (const auto& [label, _]: models) labels.push_back(label);
+
+            vector<vector<float>> model_bits(models.size());
+
+            for (size_t d = 0; d < documents.size(); d++) {
+                for (size_t i = 0; i < labels.size(); i++)
+                    model_bits[i] = models.at(labels[i]).estimate_bits(documents[d], smoothing_factors, fold_models[folds[d]].at(labels[i]));
+
+                tally(labels, model_bits, document_labels[d], results);
+            }
+        }
+
         uint32_t count(const string& label, const string& predicted_label) {
             return confusion_matrix[label][predicted_label];
         }
@@ -218,6 +476,10 @@ class FiniteContextModelEvaluator {
 
             cout << "Total: " << count() << endl;
             cout << "Accuracy: " << accuracy() << endl;
+
+            if (is_ratio)
+                return;
+
             cout << "Total bits: " << bits << endl;
             cout << "Average bits: " << average_bits() << endl;
         }
@@ -0,0 +1,330 @@
+#ifndef FINITE_CONTEXT_MODEL_SERVER_HPP_
+#define FINITE_CONTEXT_MODEL_SERVER_HPP_
+
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <csignal>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <chrono>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "finite_context_model_evaluator.hpp"
+#include "work_queue.hpp"
+
+using namespace std;
+
+// Largest document a client may send in one request.
+const uint32_t MAX_REQUEST_SIZE = 64 << 20;
+
+// Requests read but not yet picked up by a worker.
+const size_t PENDING_REQUESTS = 64;
+
+// Connections that stall this long within a request or while their response is sent are closed.
+const int REQUEST_TIMEOUT_SECONDS = 10;
+
+// Connections without a request for this long are closed.
+const int IDLE_CONNECTION_SECONDS = 300;
+
+// Longest the poller sleeps before looking for idle connections.
+const int POLL_INTERVAL_MILLISECONDS = 1000;
+
+// Pause before accepting again when the process or system is out of file descriptors.
+const int ACCEPT_BACKOFF_MILLISECONDS = 100;
+
+// Answers scoring requests over a Unix domain socket with models loaded once. A request is a
+// uint32 length in native byte order followed by that many bytes of text; the response is a
+// uint32 length followed by the predicted label on the first line and one "label\tbits" line per
+// label. Clients may send any number of requests on a connection. The listening thread polls
+// the open connections and reads requests as their bytes arrive; each complete request is queued
+// to a pool of worker threads sharing the read-only evaluator, and the worker that answers it
+// hands the connection back to be polled, so idle or slow clients hold no worker. A request longer
+// than MAX_REQUEST_SIZE is answered with a single "error\t<reason>" line and the connection is
+// closed, as are connections that stall for REQUEST_TIMEOUT_SECONDS within a request or stay idle
+// for IDLE_CONNECTION_SECONDS.
+class FiniteContextModelServer {
+    private:
+        // A request being read from its connection: the length prefix, then the text.
+        struct Request {
+            int connection;
+            uint32_t size;
+            size_t received;
+            string text;
+            chrono::steady_clock::time_point active;
+        };
+
+        static inline string socket_path;
+
+        const FiniteContextModelEvaluator& evaluator;
+        size_t threads;
+
+        // Connections answered by workers, to be polled again. A byte written to the wake pipe
+        // interrupts the poller to pick them up.
+        mutex returned_lock;
+        vector<int> returned;
+        int wake_pipe[2];
+
+        static void stop(int) {
+            unlink(socket_path.c_str());
+            _exit(EXIT_SUCCESS);
+        }
+
+        // Whether the request can be handed to a worker. The text of an oversized request is
+        // never read, since it is only answered with an error.
+        static bool complete(const Request& request) {
+            return request.received >= sizeof(request.size) && (request.size > MAX_REQUEST_SIZE || request.received == sizeof(request.size) + request.size);
+        }
+
+        // Reads whatever the client has sent so far without blocking, and returns false once the
+        // connection is closed or fails.
+        static bool receive(Request& request) {
+            while (!complete(request)) {
+                char* buffer;
+                size_t size;
+
+                if (request.received < sizeof(request.size)) {
+                    buffer = (char*)&request.size + request.received;
+                    size = sizeof(request.size) - request.received;
+                } else {
+                    size_t offset = request.received - sizeof(request.size);
+                    buffer = &request.text[offset];
+                    size = request.size - offset;
+                }
+
+                ssize_t received = recv(request.connection, buffer, size, MSG_DONTWAIT);
+                if (received == 0)
+                    return false;
+                if (received < 0)
+                    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+                request.received += received;
+                if (request.received == sizeof(request.size) && request.size <= MAX_REQUEST_SIZE)
+                    request.text.resize(request.size);
+            }
+            return true;
+        }
+
+        static bool write_fully(const int& connection, const char* buffer, size_t size) {
+            while (size > 0) {
+                ssize_t sent = send(connection, buffer, size, MSG_NOSIGNAL);
+                if (sent <= 0)
+                    return false;
+
+                buffer += sent;
+                size -= sent;
+            }
+            return true;
+        }
+
+        string respond(const string& text) const {
+            Prediction prediction = evaluator.score(text);
+
+            vector<string> labels;
+            for (const auto& [label, _]: prediction.bits) labels.push_back(label);
+            sort(labels.begin(), labels.end());
+
+            ostringstream response;
+            response << prediction.label << "\n";
+            for (const string& label: labels)
+                response << label << "\t" << fixed << setprecision(6) << prediction.bits[label] << "\n";
+
+            return response.str();
+        }
+
+        static bool send_response(const int& connection, const string& response) {
+            uint32_t response_size = response.size();
+            return write_fully(connection, (char*)&response_size, sizeof(response_size)) && write_fully(connection, response.data(), response.size());
+        }
+
+        // Answers a complete request and returns whether the connection can take more.
+        bool serve(const Request& request) const {
+            if (request.size > MAX_REQUEST_SIZE) {
+                send_response(request.connection, "error\trequest of " + to_string(request.size) + " bytes exceeds the limit of " + to_string(MAX_REQUEST_SIZE) + " bytes\n");
+                return false;
+            }
+
+            return send_response(request.connection, respond(request.text));
+        }
+
+        void hand_back(const int& connection) {
+            {
+                lock_guard<mutex> guard(returned_lock);
+                returned.push_back(connection);
+            }
+
+            // A full pipe already wakes the poller, so a failed write needs no retry.
+            char wake = 0;
+            ssize_t written = write(wake_pipe[1], &wake, sizeof(wake));
+            (void)written;
+        }
+
+        // Whether a server accepts connections on the socket at address.
+        static bool in_use(const sockaddr_un& address) {
+            int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+            bool connected = connect(probe, (const sockaddr*)&address, sizeof(address)) == 0;
+            bool refused = !connected && errno == ECONNREFUSED;
+            close(probe);
+
+            return !refused;
+        }
+
+        // Keeps a client that stops reading its response from holding a worker.
+        static void set_send_timeout(const int& connection) {
+            timeval timeout = {};
+            timeout.tv_sec = REQUEST_TIMEOUT_SECONDS;
+            setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        }
+
+    public:
+        FiniteContextModelServer(const FiniteContextModelEvaluator& evaluator, const size_t& threads): evaluator(evaluator), threads(threads), wake_pipe{-1, -1} {}
+
+        // Listens on path until the process receives SIGINT or SIGTERM, which remove the socket.
+        void listen(const string& path) {
+            sockaddr_un address = {};
+            address.sun_family = AF_UNIX;
+
+            if (path.size() >= sizeof(address.sun_path)) {
+                cerr << "Error: socket path " << path << " is too long." << endl;
+                exit(EXIT_FAILURE);
+            }
+
+            strcpy(address.sun_path, path.c_str());
+
+            // Only a stale socket is removed, so that a mistyped path cannot delete a model and a
+            // second server cannot take the socket of a running one.
+            struct stat status;
+            if (lstat(path.c_str(), &status) == 0) {
+                if (!S_ISSOCK(status.st_mode)) {
+                    cerr << "Error: " << path << " exists and is not a socket." << endl;
+                    exit(EXIT_FAILURE);
+                }
+
+                if (in_use(address)) {
+                    cerr << "Error: " << path << " is in use by another server." << endl;
+                    exit(EXIT_FAILURE);
+                }
+
+                unlink(path.c_str());
+            }
+
+            int server = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (server < 0 || bind(server, (sockaddr*)&address, sizeof(address)) != 0 || ::listen(server, SOMAXCONN) != 0) {
+                cerr << "Error: cannot listen on " << path << ": " << strerror(errno) << endl;
+                exit(EXIT_FAILURE);
+            }
+
+            if (pipe2(wake_pipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+                cerr << "Error: cannot listen on " << path << ": " << strerror(errno) << endl;
+                unlink(path.c_str());
+                exit(EXIT_FAILURE);
+            }
+
+            socket_path = path;
+            signal(SIGINT, stop);
+            signal(SIGTERM, stop);
+
+            WorkQueue<Request> requests(PENDING_REQUESTS);
+
+            for (size_t i = 0; i < threads; i++)
+                thread([this, &requests]() {
+                    Request request;
+                    while (requests.pop(request)) {
+                        if (serve(request))
+                            hand_back(request.connection);
+                        else
+                            close(request.connection);
+                    }
+                }).detach();
+
+            // The wake pipe and the listening socket come first, then the connections waiting
+            // for a request, each with the part of it read so far (unused for the first two).
+            vector<pollfd> polled = {{wake_pipe[0], POLLIN, 0}, {server, POLLIN, 0}};
+            vector<Request> reading(polled.size());
+
+            while (true) {
+                if (poll(polled.data(), polled.size(), POLL_INTERVAL_MILLISECONDS) < 0) {
+                    if (errno == EINTR)
+                        continue;
+
+                    cerr << "Error: cannot poll connections on " << path << ": " << strerror(errno) << endl;
+                    unlink(path.c_str());
+                    exit(EXIT_FAILURE);
+                }
+
+                auto now = chrono::steady_clock::now();
+
+                size_t open = 2;
+                for (size_t i = 2; i < polled.size(); i++) {
+                    Request& request = reading[i];
+
+                    if (polled[i].revents != 0) {
+                        if (!receive(request)) {
+                            close(request.connection);
+                            continue;
+                        }
+
+                        request.active = now;
+                        if (complete(request)) {
+                            requests.push(move(request));
+                            continue;
+                        }
+                    } else if (now - request.active >= chrono::seconds(request.received > 0 ? REQUEST_TIMEOUT_SECONDS : IDLE_CONNECTION_SECONDS)) {
+                        close(request.connection);
+                        continue;
+                    }
+
+                    if (open != i) {
+                        polled[open] = polled[i];
+                        reading[open] = move(request);
+                    }
+                    open++;
+                }
+
+                polled.resize(open);
+                reading.resize(open);
+
+                if (polled[0].revents != 0) {
+                    char wakes[64];
+                    while (read(wake_pipe[0], wakes, sizeof(wakes)) > 0);
+
+                    lock_guard<mutex> guard(returned_lock);
+                    for (int connection : returned) {
+                        polled.push_back({connection, POLLIN, 0});
+                        reading.push_back({connection, 0, 0, "", now});
+                    }
+                    returned.clear();
+                }
+
+                if (polled[1].revents != 0) {
+                    int connection = accept(server, nullptr, nullptr);
+
+                    if (connection >= 0) {
+                        set_send_timeout(connection);
+                        polled.push_back({connection, POLLIN, 0});
+                        reading.push_back({connection, 0, 0, "", now});
+                    } else if (errno == EMFILE || errno == ENFILE) {
+                        this_thread::sleep_for(chrono::milliseconds(ACCEPT_BACKOFF_MILLISECONDS));
+                    } else if (errno != EINTR && errno != ECONNABORTED && errno != EAGAIN) {
+                        cerr << "Error: cannot accept connections on " << path << ": " << strerror(errno) << endl;
+                        unlink(path.c_str());
+                        exit(EXIT_FAILURE);
+                    }
+                }
+            }
+        }
+};
+
+#endif // FINITE_CONTEXT_MODEL_SERVER_HPP_
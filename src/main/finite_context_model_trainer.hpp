@@ -6,23 +6,88 @@
 #include <unordered_map>
 #include <string>
 #include <numeric>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <memory>
 
 #include "finite_context_model.hpp"
+#include "work_queue.hpp"
+#include "spsc_queue.hpp"
+#include "event_count.hpp"
+#include "packed_corpus.hpp"
 #include "csv.hpp"
 
 using namespace std;
 using namespace csv;
 
+// Rows handed to a training worker at a time.
+const size_t ROWS_PER_BATCH = 256;
+
+// Context events sent to a shard at a time, and batches buffered between each producer and shard.
+const size_t EVENTS_PER_BATCH = 4096;
+const size_t BATCHES_PER_QUEUE = 16;
+
+struct ContextEvent {
+    uint64_t context;
+    uint32_t label;
+    uint8_t symbol;
+};
+
 class FiniteContextModelTrainer {
+    private:
+        FiniteContextModel new_model(const string& label) const {
+            return FiniteContextModel(k, smoothing_factor, alphabet, ignore_case, scaling_factor, label, storage);
+        }
+
+        // Shard owning a context. The key is mixed first so that the shards do not pick the same
+        // bits the flat tables hash on.
+        static size_t shard(uint64_t context, const size_t& shards) {
+            context ^= context >> 33;
+            context *= 0xFF51AFD7ED558CCDULL;
+            context ^= context >> 33;
+            return context % shards;
+        }
+
     public:
         size_t k;
         float smoothing_factor;
         string alphabet;
         bool ignore_case;
         uint8_t scaling_factor;
+        ContextStorage storage;
         unordered_map<string, FiniteContextModel> models;
 
-        FiniteContextModelTrainer(const size_t &k, const float &smoothing_factor, const string &alphabet, const bool &ignore_case, const uint8_t &scaling_factor): k(k), smoothing_factor(smoothing_factor), alphabet(alphabet), ignore_case(ignore_case), scaling_factor(scaling_factor) {}
+        FiniteContextModelTrainer(const size_t &k, const float &smoothing_factor, const string &alphabet, const bool &ignore_case, const uint8_t &scaling_factor, const ContextStorage &storage = ContextStorage::HASH): k(k), smoothing_factor(smoothing_factor), alphabet(alphabet), ignore_case(ignore_case), scaling_factor(scaling_factor), storage(storage) {}
+
+        FiniteContextModel& model(const string& label) {
+            auto it = models.find(label);
+            if (it == models.end())
+                it = models.emplace(label, new_model(label)).first;
+            return it->second;
+        }
+
+        // Continues training an existing model of its label, merging it with any model of that label
+        // already held. Returns false if it was trained with a different order, alphabet, case
+        // handling or smoothing factor than the trainer.
+        bool resume(FiniteContextModel model) {
+            ContextEncoder encoder(k, alphabet, ignore_case);
+
+            if (model.k != encoder.k || model.alphabet != encoder.alphabet || model.ignore_case != encoder.ignore_case || model.smoothing_factor != smoothing_factor)
+                return false;
+
+            model.unmap();
+
+            auto it = models.find(model.id);
+            if (it == models.end()) {
+                string label = model.id;
+                models.emplace(label, move(model));
+            } else {
+                it->second.merge(model);
+            }
+
+            return true;
+        }
 
         void train(const string& input_file, const string& text_column, const string& label_column) {
             CSVReader reader(input_file);
@@ -31,35 +96,243 @@ class FiniteContextModelTrainer {
                 string text = row[text_column].get<>();
                 string label = row[label_column].get<>();
 
-                if (models.find(label) == models.end()) 
-                    models.emplace(label, FiniteContextModel(k, smoothing_factor, alphabet, ignore_case, scaling_factor, label));
+                model(label).update(text);
+            }
+        }
+
+        // Trains on rows packed with corpus_pack, which must match the alphabet and case handling.
+        void train(const PackedCorpus& corpus) {
+            corpus.for_each([this](const string& label, const uint8_t* symbols, const size_t& size) {
+                model(label).update(symbols, size);
+            });
+        }
+
+        // Parallel version of train: the calling thread reads the rows in batches and threads
+        // workers count them into their own per-label models, which are merged into models once
+        // the input is exhausted. Counts are summed, so the result matches sequential training.
+        void train(const string& input_file, const string& text_column, const string& label_column, const size_t& threads) {
+            typedef vector<pair<string, string>> Batch;
+
+            WorkQueue<Batch> batches(threads * 2);
+            vector<unordered_map<string, FiniteContextModel>> partials(threads);
+            vector<thread> workers;
+
+            for (auto& partial: partials)
+                workers.emplace_back([this, &batches, &partial]() {
+                    Batch batch;
+                    while (batches.pop(batch)) {
+                        for (const auto& [text, label]: batch) {
+                            auto it = partial.find(label);
+                            if (it == partial.end())
+                                it = partial.emplace(label, new_model(label)).first;
+
+                            it->second.update(text);
+                        }
+                    }
+                });
+
+            CSVReader reader(input_file);
+            Batch batch;
+
+            for (CSVRow& row: reader) {
+                batch.emplace_back(row[text_column].get<>(), row[label_column].get<>());
+
+                if (batch.size() == ROWS_PER_BATCH) {
+                    batches.push(move(batch));
+                    batch = Batch();
+                }
+            }
+
+            if (!batch.empty())
+                batches.push(move(batch));
+
+            batches.close();
+
+            for (thread& worker: workers)
+                worker.join();
+
+            for (auto& partial: partials) {
+                for (auto& [label, model]: partial) {
+                    auto it = models.find(label);
+                    if (it == models.end())
+                        models.emplace(label, move(model));
+                    else
+                        it->second.merge(model);
+                }
+                partial.clear();
+            }
+        }
+
+        // Concurrent training without per-thread replicas: every context belongs to one of shards
+        // owner threads, which alone update its counts. producers threads turn the rows read by the
+        // calling thread into (context, symbol) events and hand them to the owners in batches, over
+        // one lock-free queue per producer and shard. The disjoint shards are then moved into models.
+        void train_partitioned(const string& input_file, const string& text_column, const string& label_column, const size_t& producers, const size_t& shards) {
+            typedef vector<pair<string, uint32_t>> Batch;
+            typedef vector<ContextEvent> Events;
+
+            ContextEncoder encoder(k, alphabet, ignore_case);
+            WorkQueue<Batch> batches(producers * 2);
+
+            vector<unique_ptr<SpscQueue<Events>>> queues;
+            for (size_t i = 0; i < producers * shards; i++)
+                queues.push_back(make_unique<SpscQueue<Events>>(BATCHES_PER_QUEUE));
+
+            // Signalled when a batch is queued for a shard or a producer finishes, so that idle
+            // owners can sleep instead of polling their queues.
+            vector<unique_ptr<EventCount>> ready;
+            for (size_t s = 0; s < shards; s++)
+                ready.push_back(make_unique<EventCount>());
+
+            atomic<size_t> finished(0);
+            vector<vector<FiniteContextModel>> shard_models(shards);
+            vector<thread> owners;
+
+            for (size_t s = 0; s < shards; s++)
+                owners.emplace_back([this, &queues, &ready, &finished, &shard_models, producers, shards, s]() {
+                    vector<FiniteContextModel>& owned = shard_models[s];
+                    Events events;
+                    size_t idle_rounds = 0;
+
+                    while (true) {
+                        uint64_t key = ready[s]->prepare();
+                        bool done = finished.load(memory_order_acquire) == producers;
+                        bool idle = true;
+
+                        for (size_t p = 0; p < producers; p++) {
+                            while (queues[p * shards + s]->try_pop(events)) {
+                                idle = false;
+
+                                for (const ContextEvent& event: events) {
+                                    while (owned.size() <= event.label)
+                                        owned.push_back(new_model(""));
+
+                                    owned[event.label].increment(event.context, event.symbol);
+                                }
+                            }
+                        }
+
+                        if (!idle) {
+                            idle_rounds = 0;
+                        } else if (done) {
+                            break;
+                        } else if (++idle_rounds < SPINS_BEFORE_WAIT) {
+                            this_thread::yield();
+                        } else {
+                            ready[s]->wait(key);
+                        }
+                    }
+                });
+
+            vector<thread> workers;
+
+            for (size_t p = 0; p < producers; p++)
+                workers.emplace_back([&encoder, &batches, &queues, &ready, &finished, shards, p]() {
+                    vector<Events> pending(shards);
+
+                    auto flush = [&queues, &ready, &pending, shards, p](const size_t& s) {
+                        queues[p * shards + s]->push(move(pending[s]));
+                        ready[s]->notify();
+                        pending[s] = Events();
+                        pending[s].reserve(EVENTS_PER_BATCH);
+                    };
+
+                    for (Events& events: pending)
+                        events.reserve(EVENTS_PER_BATCH);
+
+                    Batch batch;
+                    while (batches.pop(batch)) {
+                        for (const auto& [text, label]: batch) {
+                            encoder.for_each_context(text, [&pending, &flush, shards, label = label](const uint64_t& context, const uint8_t& symbol) {
+                                size_t s = shard(context, shards);
+                                pending[s].push_back({context, label, symbol});
+
+                                if (pending[s].size() == EVENTS_PER_BATCH)
+                                    flush(s);
+                            });
+                        }
+                    }
+
+                    for (size_t s = 0; s < shards; s++)
+                        if (!pending[s].empty())
+                            flush(s);
+
+                    finished.fetch_add(1, memory_order_release);
+                    for (auto& shard_ready: ready)
+                        shard_ready->notify();
+                });
+
+            vector<string> labels;
+            unordered_map<string, uint32_t> label_ids;
+
+            CSVReader reader(input_file);
+            Batch batch;
+
+            for (CSVRow& row: reader) {
+                string label = row[label_column].get<>();
+
+                auto it = label_ids.find(label);
+                if (it == label_ids.end()) {
+                    it = label_ids.emplace(label, labels.size()).first;
+                    labels.push_back(label);
+                }
+
+                batch.emplace_back(row[text_column].get<>(), it->second);
+
+                if (batch.size() == ROWS_PER_BATCH) {
+                    batches.push(move(batch));
+                    batch = Batch();
+                }
+            }
+
+            if (!batch.empty())
+                batches.push(move(batch));
+
+            batches.close();
+
+            for (thread& worker: workers)
+                worker.join();
+
+            for (thread& owner: owners)
+                owner.join();
 
-                models[label].update(text);
+            for (size_t label = 0; label < labels.size(); label++) {
+                auto it = models.find(labels[label]);
+                if (it == models.end())
+                    it = models.emplace(labels[label], new_model(labels[label])).first;
+
+                size_t contexts = it->second.contexts();
+                for (const auto& owned: shard_models)
+                    if (label < owned.size())
+                        contexts += owned[label].contexts();
+
+                it->second.reserve(contexts);
+
+                for (auto& owned: shard_models) {
+                    if (label < owned.size()) {
+                        it->second.merge(owned[label]);
+                        owned[label] = FiniteContextModel();
+                    }
+                }
             }
         }
 
         void train(string& text, const string& label) {
-            if (models.find(label) == models.end()) 
-                models.emplace(label, FiniteContextModel(k, smoothing_factor, alphabet, ignore_case, scaling_factor, label));
-            
-            models[label].update(text);
+            model(label).update(text);
         }
 
         void train(ifstream& input, const string& label) {
-            if (models.find(label) == models.end()) 
-                models.emplace(label, FiniteContextModel(k, smoothing_factor, alphabet, ignore_case, scaling_factor, label));
-
-            models[label].update(input);
+            model(label).update(input);
         }
 
-        void save() {
+        void save(const ModelFormat& format = ModelFormat::STANDARD) {
             for (auto& [label, model]: models)
-                model.save(label + ".bin");
+                model.save(label + ".bin", format);
         }
 
-        void save(unordered_map<string, string> &filenames) {
+        void save(unordered_map<string, string> &filenames, const ModelFormat& format = ModelFormat::STANDARD) {
             for (auto& [label, model]: models)
-                model.save(filenames[label]);
+                model.save(filenames[label], format);
         }
 };
 
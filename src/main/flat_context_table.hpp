@@ -0,0 +1,144 @@
+#ifndef FLAT_CONTEXT_TABLE_HPP_
+#define FLAT_CONTEXT_TABLE_HPP_
+
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+// Open-addressing hash table from context key to T (an EventMap for count models). Slots live in
+// one contiguous array whose size is a power of two and collisions are resolved by linear probing.
+// Context keys are always below |alphabet|^k <= UINT64_MAX, so UINT64_MAX marks an empty slot.
+template <typename T>
+class FlatContextTable {
+    public:
+        static constexpr uint64_t EMPTY = UINT64_MAX;
+
+        struct Slot {
+            uint64_t key = EMPTY;
+            T value = {};
+        };
+
+        template <typename S>
+        class basic_iterator {
+            public:
+                basic_iterator(S *slot, S *end): slot(slot), end(end) { skip(); }
+
+                S &operator*() const { return *slot; }
+                S *operator->() const { return slot; }
+                basic_iterator &operator++() { slot++; skip(); return *this; }
+                bool operator!=(const basic_iterator &other) const { return slot != other.slot; }
+
+            private:
+                S *slot;
+                S *end;
+
+                void skip() {
+                    while (slot != end && slot->key == EMPTY)
+                        slot++;
+                }
+        };
+
+        typedef basic_iterator<Slot> iterator;
+        typedef basic_iterator<const Slot> const_iterator;
+
+        vector<Slot> slots;
+        size_t used;
+
+        FlatContextTable(): used(0) {}
+
+        T *find(const uint64_t &key) {
+            if (slots.empty())
+                return nullptr;
+
+            for (size_t i = position(key); ; i = (i + 1) & mask()) {
+                if (slots[i].key == key)
+                    return &slots[i].value;
+                if (slots[i].key == EMPTY)
+                    return nullptr;
+            }
+        }
+
+        const T *find(const uint64_t &key) const {
+            return const_cast<FlatContextTable*>(this)->find(key);
+        }
+
+        T &operator[](const uint64_t &key) {
+            if ((used + 1) * 4 > slots.size() * 3)
+                rehash(slots.empty() ? 16 : slots.size() * 2);
+
+            size_t i = position(key);
+            while (slots[i].key != key && slots[i].key != EMPTY)
+                i = (i + 1) & mask();
+
+            if (slots[i].key == EMPTY) {
+                slots[i].key = key;
+                used++;
+            }
+
+            return slots[i].value;
+        }
+
+        void reserve(const size_t &contexts) {
+            size_t capacity = 16;
+            while (contexts * 4 > capacity * 3)
+                capacity *= 2;
+
+            if (capacity > slots.size())
+                rehash(capacity);
+        }
+
+        size_t size() const {
+            return used;
+        }
+
+        void clear() {
+            slots.clear();
+            used = 0;
+        }
+
+        iterator begin() {
+            return iterator(slots.data(), slots.data() + slots.size());
+        }
+
+        iterator end() {
+            return iterator(slots.data() + slots.size(), slots.data() + slots.size());
+        }
+
+        const_iterator begin() const {
+            return const_iterator(slots.data(), slots.data() + slots.size());
+        }
+
+        const_iterator end() const {
+            return const_iterator(slots.data() + slots.size(), slots.data() + slots.size());
+        }
+
+    private:
+        size_t mask() const {
+            return slots.size() - 1;
+        }
+
+        // Fibonacci hashing spreads the mostly sequential context keys over the table.
+        size_t position(const uint64_t &key) const {
+            return (key * 0x9E3779B97F4A7C15ULL) >> (64 - __builtin_ctzll(slots.size()));
+        }
+
+        void rehash(const size_t &capacity) {
+            vector<Slot> old_slots(capacity);
+            old_slots.swap(slots);
+
+            for (Slot &slot : old_slots) {
+                if (slot.key == EMPTY)
+                    continue;
+
+                size_t i = position(slot.key);
+                while (slots[i].key != EMPTY)
+                    i = (i + 1) & mask();
+
+                slots[i].key = slot.key;
+                slots[i].value = move(slot.value);
+            }
+        }
+};
+
+#endif // FLAT_CONTEXT_TABLE_HPP_
@@ -0,0 +1,150 @@
+#ifndef FUSED_FINITE_CONTEXT_MODEL_HPP_
+#define FUSED_FINITE_CONTEXT_MODEL_HPP_
+
+#include <fstream>
+#include <unordered_map>
+#include <vector>
+#include <string>
+#include <bitset>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "context_encoder.hpp"
+#include "flat_context_table.hpp"
+#include "finite_context_model.hpp"
+
+using namespace std;
+
+// Read-only table holding the counts of several models that share k, alphabet and case handling,
+// so that scoring a text against every label takes one pass and one lookup per symbol.
+// Each context maps to an entry whose events are event_symbols[offsets[e] .. offsets[e + 1]),
+// sorted by symbol, with the counts of label l at counts[event * labels.size() + l] and the
+// context totals at totals[e * labels.size() + l].
+class FusedFiniteContextModel : public ContextEncoder {
+    public:
+        vector<string> labels;
+        vector<float> smoothing_factors;
+        FlatContextTable<uint32_t> entries;
+        vector<uint32_t> offsets;
+        vector<uint8_t> event_symbols;
+        vector<uint32_t> counts;
+        vector<uint32_t> totals;
+
+        FusedFiniteContextModel() {}
+
+        FusedFiniteContextModel(const unordered_map<string, FiniteContextModel> &models): ContextEncoder(models.begin()->second) {
+            for (const auto &[label, model] : models) {
+                labels.push_back(label);
+                smoothing_factors.push_back(model.smoothing_factor);
+            }
+
+            vector<bitset<256>> present;
+
+            for (const auto &[label, model] : models) {
+                entries.reserve(entries.size() + model.contexts());
+
+                model.for_each_counts([this, &present](const uint64_t &context, const vector<pair<uint8_t, uint32_t>> &events, const uint32_t &) {
+                    const uint32_t *entry = entries.find(context);
+                    if (entry == nullptr) {
+                        entries[context] = present.size();
+                        present.emplace_back();
+                        entry = entries.find(context);
+                    }
+
+                    for (const auto &[symbol, count] : events)
+                        present[*entry].set(symbol);
+                });
+            }
+
+            offsets.assign(present.size() + 1, 0);
+            for (size_t entry = 0; entry < present.size(); entry++) {
+                offsets[entry + 1] = offsets[entry] + present[entry].count();
+
+                for (size_t symbol = 0; symbol < alphabet.size(); symbol++)
+                    if (present[entry].test(symbol))
+                        event_symbols.push_back(symbol);
+            }
+
+            present = vector<bitset<256>>();
+
+            counts.assign(event_symbols.size() * labels.size(), 0);
+            totals.assign((offsets.size() - 1) * labels.size(), 0);
+
+            size_t label = 0;
+            for (const auto &[_, model] : models) {
+                model.for_each_counts([this, &label](const uint64_t &context, const vector<pair<uint8_t, uint32_t>> &events, const uint32_t &total) {
+                    uint32_t entry = *entries.find(context);
+                    totals[entry * labels.size() + label] = total;
+
+                    for (const auto &[symbol, count] : events)
+                        counts[event(entry, symbol) * labels.size() + label] = count;
+                });
+                label++;
+            }
+        }
+
+        static bool compatible(const unordered_map<string, FiniteContextModel> &models) {
+            if (models.empty())
+                return false;
+
+            const FiniteContextModel &first = models.begin()->second;
+
+            for (const auto &[_, model] : models)
+                if (model.k != first.k || model.alphabet != first.alphabet || model.ignore_case != first.ignore_case)
+                    return false;
+
+            return true;
+        }
+
+        // Position of symbol among the events of entry, or SIZE_MAX if it never followed the context.
+        size_t event(const uint32_t &entry, const uint8_t &symbol) const {
+            auto first = event_symbols.begin() + offsets[entry];
+            auto last = event_symbols.begin() + offsets[entry + 1];
+            auto it = lower_bound(first, last, symbol);
+
+            if (it == last || *it != symbol)
+                return SIZE_MAX;
+
+            return it - event_symbols.begin();
+        }
+
+        void add_bits(vector<float> &bits, const uint64_t &context, const uint8_t &symbol) const {
+            const uint32_t *context_totals = nullptr;
+            const uint32_t *event_counts = nullptr;
+
+            const uint32_t *entry = entries.find(context);
+            if (entry != nullptr) {
+                context_totals = &totals[*entry * labels.size()];
+
+                size_t position = event(*entry, symbol);
+                if (position != SIZE_MAX)
+                    event_counts = &counts[position * labels.size()];
+            }
+
+            for (size_t label = 0; label < labels.size(); label++) {
+                uint32_t count = event_counts == nullptr ? 0 : event_counts[label];
+                uint32_t total = context_totals == nullptr ? 0 : context_totals[label];
+                float probability = (count + smoothing_factors[label]) / (total + alphabet.size() * smoothing_factors[label]);
+                bits[label] += -log2(probability);
+            }
+        }
+
+        vector<float> estimate_bits(ifstream &input) const {
+            vector<float> bits(labels.size(), 0);
+            for_each_context(input, [this, &bits](const uint64_t &context, const uint8_t &symbol) {
+                add_bits(bits, context, symbol);
+            });
+            return bits;
+        }
+
+        vector<float> estimate_bits(const string &text) const {
+            vector<float> bits(labels.size(), 0);
+            for_each_context(text, [this, &bits](const uint64_t &context, const uint8_t &symbol) {
+                add_bits(bits, context, symbol);
+            });
+            return bits;
+        }
+};
+
+#endif // FUSED_FINITE_CONTEXT_MODEL_HPP_
@@ -0,0 +1,389 @@
+#ifndef LOG_RATIO_TABLE_HPP_
+#define LOG_RATIO_TABLE_HPP_
+
+#include <iostream>
+#include <fstream>
+#include <unordered_map>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "context_encoder.hpp"
+#include "flat_context_table.hpp"
+#include "finite_context_model.hpp"
+#include "file_publishing.hpp"
+
+using namespace std;
+
+const char RATIO_FILE_MAGIC[8] = {'F', 'C', 'R', 'A', 'T', 'I', 'O', '\0'};
+const uint8_t RATIO_FILE_VERSION = 2;
+
+// Number of quantized ratios gathered before they are summed with SIMD instructions.
+const size_t QUANTIZED_BATCH = 256;
+
+// Frozen two-label table of log-likelihood ratios: for every (context, event) it stores
+// bits(labels[0]) - bits(labels[1]) with the smoothing factors of the source models applied,
+// plus a per-context default for events neither model saw after that context. Contexts map to
+// entries whose events are event_symbols[offsets[e] .. offsets[e + 1]), sorted by symbol.
+// A quantized table keeps the same layout with the ratios stored as int16 fixed-point values
+// with fraction_bits fractional bits, and sums them exactly in 64-bit integers.
+class LogRatioTable : public ContextEncoder {
+    private:
+        void read_value(ifstream &input, vector<float> &values, vector<int16_t> &quantized_values) {
+            if (quantized) {
+                int16_t value;
+                input.read((char*)&value, sizeof(value));
+                quantized_values.push_back(value);
+            } else {
+                float value;
+                input.read((char*)&value, sizeof(value));
+                values.push_back(value);
+            }
+        }
+
+        void write_value(ofstream &output, const vector<float> &values, const vector<int16_t> &quantized_values, const size_t &i) const {
+            if (quantized)
+                output.write((char*)&quantized_values[i], sizeof(quantized_values[i]));
+            else
+                output.write((char*)&values[i], sizeof(values[i]));
+        }
+
+        void add_entry(const uint64_t &context) {
+            entries[context] = offsets.size();
+            offsets.push_back(event_symbols.size());
+        }
+
+        template <typename T>
+        T lookup(const uint64_t &context, const uint8_t &symbol, const vector<T> &values, const vector<T> &context_defaults, const T &unseen_value) const {
+            const uint32_t *entry = entries.find(context);
+            if (entry == nullptr)
+                return unseen_value;
+
+            auto first = event_symbols.begin() + offsets[*entry];
+            auto last = event_symbols.begin() + offsets[*entry + 1];
+            auto it = lower_bound(first, last, symbol);
+
+            if (it == last || *it != symbol)
+                return context_defaults[*entry];
+
+            return values[it - event_symbols.begin()];
+        }
+
+        static int64_t sum_scalar(const int16_t *values, const size_t &size) {
+            int64_t sum = 0;
+            for (size_t i = 0; i < size; i++)
+                sum += values[i];
+            return sum;
+        }
+
+#if defined(__x86_64__) || defined(__i386__)
+        __attribute__((target("avx2")))
+        static int64_t sum_avx2(const int16_t *values, const size_t &size) {
+            __m256i ones = _mm256_set1_epi16(1);
+            __m256i sums = _mm256_setzero_si256();
+
+            size_t i = 0;
+            for (; i + 16 <= size; i += 16) {
+                __m256i batch = _mm256_loadu_si256((const __m256i*)(values + i));
+                sums = _mm256_add_epi32(sums, _mm256_madd_epi16(batch, ones));
+            }
+
+            int32_t lanes[8];
+            _mm256_storeu_si256((__m256i*)lanes, sums);
+
+            int64_t sum = 0;
+            for (int32_t lane : lanes)
+                sum += lane;
+
+            return sum + sum_scalar(values + i, size - i);
+        }
+#endif
+
+        // The batch is small enough that the eight 32-bit lanes cannot overflow. Targets other
+        // than x86 always sum with sum_scalar.
+        static int64_t sum(const int16_t *values, const size_t &size) {
+#if defined(__x86_64__) || defined(__i386__)
+            static const bool avx2 = __builtin_cpu_supports("avx2");
+            return avx2 ? sum_avx2(values, size) : sum_scalar(values, size);
+#else
+            return sum_scalar(values, size);
+#endif
+        }
+
+    public:
+        string labels[2];
+        FlatContextTable<uint32_t> entries;
+        vector<uint32_t> offsets;
+        vector<uint8_t> event_symbols;
+        float unseen;
+        vector<float> defaults;
+        vector<float> ratios;
+        bool quantized;
+        uint8_t fraction_bits;
+        int16_t quantized_unseen;
+        vector<int16_t> quantized_defaults;
+        vector<int16_t> quantized_ratios;
+
+        LogRatioTable(): unseen(0), quantized(false), fraction_bits(0), quantized_unseen(0) {}
+
+        LogRatioTable(const string &input_file): LogRatioTable() {
+            load(input_file);
+        }
+
+        LogRatioTable(const FiniteContextModel &first, const FiniteContextModel &second): ContextEncoder(first), quantized(false), fraction_bits(0), quantized_unseen(0) {
+            const FiniteContextModel *models[2] = {&first, &second};
+            labels[0] = first.id;
+            labels[1] = second.id;
+
+            unseen = bits(0, 0, first.smoothing_factor, alphabet.size()) - bits(0, 0, second.smoothing_factor, alphabet.size());
+
+            vector<uint64_t> contexts;
+            for (const FiniteContextModel *model : models)
+                model->for_each_counts([&contexts](const uint64_t &context, const vector<pair<uint8_t, uint32_t>> &, const uint32_t &) {
+                    contexts.push_back(context);
+                });
+
+            sort(contexts.begin(), contexts.end());
+            contexts.erase(unique(contexts.begin(), contexts.end()), contexts.end());
+
+            entries.reserve(contexts.size());
+            offsets.reserve(contexts.size() + 1);
+            defaults.reserve(contexts.size());
+
+            for (const uint64_t &context : contexts) {
+                ContextEntry counts[2] = {first.find(context), second.find(context)};
+
+                add_entry(context);
+                defaults.push_back(bits(0, counts[0].total, first.smoothing_factor, alphabet.size()) - bits(0, counts[1].total, second.smoothing_factor, alphabet.size()));
+
+                for (size_t symbol = 0; symbol < alphabet.size(); symbol++) {
+                    if (counts[0].count(symbol) == 0 && counts[1].count(symbol) == 0)
+                        continue;
+
+                    event_symbols.push_back(symbol);
+                    ratios.push_back(bits(counts[0].count(symbol), counts[0].total, first.smoothing_factor, alphabet.size()) - bits(counts[1].count(symbol), counts[1].total, second.smoothing_factor, alphabet.size()));
+                }
+            }
+
+            offsets.push_back(event_symbols.size());
+        }
+
+        static double bits(const uint32_t &count, const uint32_t &total, const float &smoothing_factor, const size_t &alphabet_size) {
+            return -log2((count + static_cast<double>(smoothing_factor)) / (total + alphabet_size * static_cast<double>(smoothing_factor)));
+        }
+
+        // Converts the ratios to int16 fixed point, using as many fractional bits as the largest
+        // finite magnitude allows. The float ratios are released afterwards.
+        void quantize() {
+            double max_ratio = 0;
+            for (const vector<float> *values : {&defaults, &ratios})
+                for (float value : *values)
+                    if (isfinite(value))
+                        max_ratio = max<double>(max_ratio, fabs(value));
+            if (isfinite(unseen))
+                max_ratio = max<double>(max_ratio, fabs(unseen));
+
+            fraction_bits = 0;
+            while (fraction_bits < 14 && max_ratio * (1 << (fraction_bits + 1)) <= INT16_MAX)
+                fraction_bits++;
+
+            auto to_fixed = [this](const float &value) {
+                return static_cast<int16_t>(max<double>(-INT16_MAX, min<double>(INT16_MAX, round(ldexp(value, fraction_bits)))));
+            };
+
+            quantized_unseen = to_fixed(unseen);
+            quantized_defaults.resize(defaults.size());
+            transform(defaults.begin(), defaults.end(), quantized_defaults.begin(), to_fixed);
+            quantized_ratios.resize(ratios.size());
+            transform(ratios.begin(), ratios.end(), quantized_ratios.begin(), to_fixed);
+
+            defaults = vector<float>();
+            ratios = vector<float>();
+            quantized = true;
+        }
+
+        float ratio(const uint64_t &context, const uint8_t &symbol) const {
+            return lookup(context, symbol, ratios, defaults, unseen);
+        }
+
+        int16_t quantized_ratio(const uint64_t &context, const uint8_t &symbol) const {
+            return lookup(context, symbol, quantized_ratios, quantized_defaults, quantized_unseen);
+        }
+
+        // bits(labels[0]) - bits(labels[1]) of the whole input; negative values favour labels[0].
+        double estimate_ratio(ifstream &input) const {
+            if (quantized)
+                return ldexp(static_cast<double>(estimate_quantized_ratio(input)), -fraction_bits);
+
+            double total = 0;
+            for_each_context(input, [this, &total](const uint64_t &context, const uint8_t &symbol) {
+                total += ratio(context, symbol);
+            });
+            return total;
+        }
+
+        double estimate_ratio(const string &text) const {
+            if (quantized)
+                return ldexp(static_cast<double>(estimate_quantized_ratio(text)), -fraction_bits);
+
+            double total = 0;
+            for_each_context(text, [this, &total](const uint64_t &context, const uint8_t &symbol) {
+                total += ratio(context, symbol);
+            });
+            return total;
+        }
+
+        // Sum of the fixed-point ratios, gathered in batches that are added up with AVX2 when available.
+        template <typename Input>
+        int64_t estimate_quantized_ratio(Input &input) const {
+            int64_t total = 0;
+            int16_t batch[QUANTIZED_BATCH];
+            size_t size = 0;
+
+            for_each_context(input, [this, &total, &batch, &size](const uint64_t &context, const uint8_t &symbol) {
+                batch[size++] = quantized_ratio(context, symbol);
+                if (size == QUANTIZED_BATCH) {
+                    total += sum(batch, size);
+                    size = 0;
+                }
+            });
+
+            return total + sum(batch, size);
+        }
+
+        void load(const string &input_file) {
+            ifstream input(input_file, ios::binary);
+
+            char magic[sizeof(RATIO_FILE_MAGIC)];
+            input.read(magic, sizeof(magic));
+
+            if (memcmp(magic, RATIO_FILE_MAGIC, sizeof(magic)) != 0) {
+                cerr << "Error: " << input_file << " is not a log ratio table." << endl;
+                exit(EXIT_FAILURE);
+            }
+
+            uint8_t version;
+            input.read((char*)&version, sizeof(version));
+
+            quantized = false;
+            fraction_bits = 0;
+            if (version >= 2) {
+                input.read((char*)&quantized, sizeof(quantized));
+                input.read((char*)&fraction_bits, sizeof(fraction_bits));
+            }
+
+            for (string &label : labels) {
+                size_t label_size;
+                input.read((char*)&label_size, sizeof(label_size));
+                label.resize(label_size);
+                input.read(&label[0], label_size);
+            }
+
+            input.read((char*)&k, sizeof(k));
+            input.read((char*)&ignore_case, sizeof(ignore_case));
+
+            size_t alphabet_size;
+            input.read((char*)&alphabet_size, sizeof(alphabet_size));
+            alphabet.resize(alphabet_size);
+            input.read(&alphabet[0], alphabet_size);
+
+            init_symbols();
+
+            if (quantized)
+                input.read((char*)&quantized_unseen, sizeof(quantized_unseen));
+            else
+                input.read((char*)&unseen, sizeof(unseen));
+
+            size_t entries_size;
+            input.read((char*)&entries_size, sizeof(entries_size));
+
+            entries.reserve(entries_size);
+            offsets.reserve(entries_size + 1);
+
+            for (size_t i = 0; i < entries_size; i++) {
+                uint64_t context;
+                input.read((char*)&context, sizeof(context));
+                add_entry(context);
+                read_value(input, defaults, quantized_defaults);
+
+                size_t events_size;
+                input.read((char*)&events_size, sizeof(events_size));
+
+                for (size_t j = 0; j < events_size; j++) {
+                    uint8_t symbol;
+                    input.read((char*)&symbol, sizeof(symbol));
+                    event_symbols.push_back(symbol);
+                    read_value(input, ratios, quantized_ratios);
+                }
+            }
+
+            offsets.push_back(event_symbols.size());
+
+            input.close();
+        }
+
+        // Published through a temporary file next to the target, as models are.
+        void save(const string &output_path) const {
+            string output_file = resolve_path(output_path);
+            string temporary_file = create_temporary(output_file);
+
+            ofstream output(temporary_file, ios::binary);
+
+            output.write(RATIO_FILE_MAGIC, sizeof(RATIO_FILE_MAGIC));
+            output.write((char*)&RATIO_FILE_VERSION, sizeof(RATIO_FILE_VERSION));
+            output.write((char*)&quantized, sizeof(quantized));
+            output.write((char*)&fraction_bits, sizeof(fraction_bits));
+
+            for (const string &label : labels) {
+                size_t label_size = label.size();
+                output.write((char*)&label_size, sizeof(label_size));
+                output.write(label.c_str(), label.size());
+            }
+
+            output.write((char*)&k, sizeof(k));
+            output.write((char*)&ignore_case, sizeof(ignore_case));
+
+            size_t alphabet_size = alphabet.size();
+            output.write((char*)&alphabet_size, sizeof(alphabet_size));
+            output.write(alphabet.c_str(), alphabet.size());
+
+            if (quantized)
+                output.write((char*)&quantized_unseen, sizeof(quantized_unseen));
+            else
+                output.write((char*)&unseen, sizeof(unseen));
+
+            size_t entries_size = offsets.size() - 1;
+            output.write((char*)&entries_size, sizeof(entries_size));
+
+            for (const auto &[context, entry] : entries) {
+                output.write((char*)&context, sizeof(context));
+                write_value(output, defaults, quantized_defaults, entry);
+
+                size_t events_size = offsets[entry + 1] - offsets[entry];
+                output.write((char*)&events_size, sizeof(events_size));
+
+                for (uint32_t event = offsets[entry]; event < offsets[entry + 1]; event++) {
+                    output.write((char*)&event_symbols[event], sizeof(event_symbols[event]));
+                    write_value(output, ratios, quantized_ratios, event);
+                }
+            }
+
+            output.close();
+
+            if (output.fail()) {
+                unlink(temporary_file.c_str());
+                cerr << "Error: cannot write " << output_file << "." << endl;
+                exit(EXIT_FAILURE);
+            }
+
+            publish(temporary_file, output_file);
+        }
+};
+
+#endif // LOG_RATIO_TABLE_HPP_
@@ -0,0 +1,166 @@
+#ifndef MAPPED_CONTEXT_TABLE_HPP_
+#define MAPPED_CONTEXT_TABLE_HPP_
+
+#include <iostream>
+#include <fstream>
+#include <memory>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstdint>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Read-only count table used in place from a memory-mapped model file. The block holds a Header,
+// an open-addressing table of Slots (Fibonacci hash and linear probing, as in FlatContextTable),
+// then the counts and symbols of the events of every context, sorted by symbol, at
+// [offset, offset + size) of the counts and symbols arrays. Nothing is parsed when a model is
+// loaded; pages are only faulted in as lookups touch them.
+class MappedContextTable {
+    public:
+        static constexpr uint64_t EMPTY = UINT64_MAX;
+        static constexpr size_t ALIGNMENT = 64;
+
+        struct Header {
+            uint64_t capacity;
+            uint64_t contexts;
+            uint64_t events;
+            uint64_t reserved;
+        };
+
+        struct Slot {
+            uint64_t key;
+            uint32_t total;
+            uint32_t offset;
+            uint32_t size;
+            uint32_t reserved;
+        };
+
+        const Header *header;
+        const Slot *slots;
+        const uint32_t *counts;
+        const uint8_t *symbols;
+
+        MappedContextTable(): header(nullptr), slots(nullptr), counts(nullptr), symbols(nullptr) {}
+
+        // Maps input_file, whose table block starts at offset, for reading.
+        void open(const string &input_file, const uint64_t &offset) {
+            int descriptor = ::open(input_file.c_str(), O_RDONLY);
+
+            struct stat status;
+            if (descriptor < 0 || fstat(descriptor, &status) != 0 || static_cast<uint64_t>(status.st_size) < offset + sizeof(Header)) {
+                cerr << "Error: cannot map " << input_file << "." << endl;
+                exit(EXIT_FAILURE);
+            }
+
+            void *address = mmap(nullptr, status.st_size, PROT_READ, MAP_SHARED, descriptor, 0);
+            ::close(descriptor);
+
+            if (address == MAP_FAILED) {
+                cerr << "Error: cannot map " << input_file << "." << endl;
+                exit(EXIT_FAILURE);
+            }
+
+            madvise(address, status.st_size, MADV_RANDOM);
+            mapping = shared_ptr<void>(address, [size = status.st_size](void *address) { munmap(address, size); });
+
+            const char *block = static_cast<const char*>(address) + offset;
+            const Header *block_header = reinterpret_cast<const Header*>(block);
+
+            // A truncated or half-written file must fail here rather than fault at query time.
+            uint64_t available = status.st_size - offset - sizeof(Header);
+            if (block_header->capacity == 0 || (block_header->capacity & (block_header->capacity - 1)) != 0 ||
+                block_header->capacity > available / sizeof(Slot) ||
+                block_header->events > (available - block_header->capacity * sizeof(Slot)) / (sizeof(uint32_t) + sizeof(uint8_t))) {
+                cerr << "Error: cannot map " << input_file << "." << endl;
+                exit(EXIT_FAILURE);
+            }
+
+            header = block_header;
+            slots = reinterpret_cast<const Slot*>(header + 1);
+            counts = reinterpret_cast<const uint32_t*>(slots + header->capacity);
+            symbols = reinterpret_cast<const uint8_t*>(counts + header->events);
+        }
+
+        const Slot *find(const uint64_t &key) const {
+            if (header == nullptr)
+                return nullptr;
+
+            for (size_t i = position(key, header->capacity); ; i = (i + 1) & (header->capacity - 1)) {
+                if (slots[i].key == key)
+                    return &slots[i];
+                if (slots[i].key == EMPTY)
+                    return nullptr;
+            }
+        }
+
+        size_t size() const {
+            return header == nullptr ? 0 : header->contexts;
+        }
+
+        // Calls f(slot) for every stored context.
+        template <typename F>
+        void for_each(F f) const {
+            if (header == nullptr)
+                return;
+
+            for (size_t i = 0; i < header->capacity; i++)
+                if (slots[i].key != EMPTY)
+                    f(slots[i]);
+        }
+
+        // Writes the block of contexts contexts, padded to ALIGNMENT bytes from the start of the
+        // file. for_each_counts(g) must call g(context, events, total) for each of them, with the
+        // events sorted by symbol.
+        template <typename F>
+        static void write(ofstream &output, const size_t &contexts, F for_each_counts) {
+            Header block_header = {16, contexts, 0, 0};
+            while (contexts * 4 > block_header.capacity * 3)
+                block_header.capacity *= 2;
+
+            vector<Slot> table(block_header.capacity, {EMPTY, 0, 0, 0, 0});
+            vector<uint32_t> event_counts;
+            vector<uint8_t> event_symbols;
+
+            for_each_counts([&](const uint64_t &context, const vector<pair<uint8_t, uint32_t>> &events, const uint32_t &total) {
+                size_t i = position(context, block_header.capacity);
+                while (table[i].key != EMPTY)
+                    i = (i + 1) & (block_header.capacity - 1);
+
+                table[i] = {context, total, static_cast<uint32_t>(event_counts.size()), static_cast<uint32_t>(events.size()), 0};
+
+                for (const auto &[symbol, count] : events) {
+                    event_symbols.push_back(symbol);
+                    event_counts.push_back(count);
+                }
+            });
+
+            block_header.events = event_counts.size();
+
+            while (static_cast<uint64_t>(output.tellp()) % ALIGNMENT != 0)
+                output.put('\0');
+
+            output.write((char*)&block_header, sizeof(block_header));
+            output.write((char*)table.data(), table.size() * sizeof(Slot));
+            output.write((char*)event_counts.data(), event_counts.size() * sizeof(uint32_t));
+            output.write((char*)event_symbols.data(), event_symbols.size());
+        }
+
+        // Offset at which the block following a header that ends at position starts.
+        static uint64_t block_offset(const uint64_t &position) {
+            return (position + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+        }
+
+    private:
+        shared_ptr<void> mapping;
+
+        static size_t position(const uint64_t &key, const uint64_t &capacity) {
+            return (key * 0x9E3779B97F4A7C15ULL) >> (64 - __builtin_ctzll(capacity));
+        }
+};
+
+#endif // MAPPED_CONTEXT_TABLE_HPP_
@@ -0,0 +1,110 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <iomanip>
+#include <chrono>
+#include <unistd.h>
+
+#include "finite_context_model.hpp"
+
+using namespace std;
+using namespace chrono;
+
+void print_usage(const char *argv0) {
+    cout << "Usage: " << argv0 << " [-o output_file] [-f format] model_file+" << endl;
+    cout << endl;
+    cout << "Merge models of the same label trained on different parts of a dataset by summing their counts." << endl;
+    cout << endl;
+    cout << "Options:" << endl;
+    cout << "  -o output_file\t\tOutput file for the merged model. (default: merged.bin)" << endl;
+    cout << "  -f format\t\t\tModel file format: standard, mapped for read-only models used in place without parsing, or compact for small files. (default: standard)" << endl;
+    cout << "  -h\t\t\t\tDisplay this help message" << endl;
+    cout << endl;
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+
+    string output_file = "merged.bin";
+    ModelFormat format = ModelFormat::STANDARD;
+
+    while ((opt = getopt(argc, argv, "o:f:h")) != -1) {
+        switch (opt) {
+            case 'o':
+                output_file = optarg;
+                break;
+            case 'f':
+                if (string(optarg) == "standard")
+                    format = ModelFormat::STANDARD;
+                else if (string(optarg) == "mapped")
+                    format = ModelFormat::MAPPED;
+                else if (string(optarg) == "compact")
+                    format = ModelFormat::COMPACT;
+                else {
+                    cerr << "Unknown format: " << optarg << endl;
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'h':
+                printf("Help\n");
+                print_usage(argv[0]);
+                exit(EXIT_SUCCESS);
+            case '?':
+                printf("Unknown option: %c\n", optopt);
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            case ':':
+                printf("Missing argument for option: %c\n", optopt);
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            default:
+                printf("Error parsing arguments\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (optind >= argc)
+    {
+        cerr << "Model files not provided" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    vector<string> model_files(argv + optind, argv + argc);
+
+    auto start_merging = high_resolution_clock::now();
+
+    // The counts are copied out of a mapped input, so that saving over it cannot pull them away.
+    FiniteContextModel merged(model_files[0]);
+    merged.unmap();
+
+    for (size_t i = 1; i < model_files.size(); i++) {
+        FiniteContextModel model(model_files[i]);
+
+        if (!FiniteContextModel::compatible(merged, model) || model.smoothing_factor != merged.smoothing_factor)
+        {
+            cerr << model_files[i] << " does not share the order, alphabet, case handling and smoothing factor of " << model_files[0] << endl;
+            exit(EXIT_FAILURE);
+        }
+
+        if (model.id != merged.id)
+        {
+            cerr << model_files[i] << " is a model of label " << model.id << ", not " << merged.id << endl;
+            exit(EXIT_FAILURE);
+        }
+
+        merged.merge(model);
+    }
+
+    auto end_merging = high_resolution_clock::now();
+
+    cout << "Merging time: " << fixed << setprecision(6) << duration_cast<duration<double>>(end_merging - start_merging).count() << "s" << endl;
+
+    auto start_saving = high_resolution_clock::now();
+
+    merged.save(output_file, format);
+
+    auto end_saving = high_resolution_clock::now();
+
+    cout << "Saving time: " << fixed << setprecision(6) << duration_cast<duration<double>>(end_saving - start_saving).count() << "s" << endl;
+}
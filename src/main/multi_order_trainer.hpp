@@ -0,0 +1,78 @@
+#ifndef MULTI_ORDER_TRAINER_HPP_
+#define MULTI_ORDER_TRAINER_HPP_
+
+#include <unordered_map>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include "finite_context_model_trainer.hpp"
+#include "context_encoder.hpp"
+#include "packed_corpus.hpp"
+#include "csv.hpp"
+
+using namespace std;
+using namespace csv;
+
+// Trains the models of several orders in a single pass over the data. Each row is parsed and
+// mapped to symbol ids once, and the contexts of every order are taken from one rolling key of
+// the highest order, so the result matches a separate FiniteContextModelTrainer run per order.
+class MultiOrderTrainer {
+    public:
+        vector<size_t> orders;
+        ContextEncoder encoder;
+        vector<FiniteContextModelTrainer> trainers;
+
+        MultiOrderTrainer(vector<size_t> orders_, const float &smoothing_factor, const string &alphabet, const bool &ignore_case, const uint8_t &scaling_factor, const ContextStorage &storage = ContextStorage::HASH): orders(orders_) {
+            sort(orders.begin(), orders.end());
+            orders.erase(unique(orders.begin(), orders.end()), orders.end());
+
+            encoder = ContextEncoder(orders.back(), alphabet, ignore_case);
+
+            for (size_t order : orders)
+                trainers.emplace_back(order, smoothing_factor, alphabet, ignore_case, scaling_factor, storage);
+        }
+
+        void train(const string& input_file, const string& text_column, const string& label_column) {
+            CSVReader reader(input_file);
+            vector<FiniteContextModel*> models(trainers.size());
+
+            for (CSVRow& row: reader) {
+                string text = row[text_column].get<>();
+                string label = row[label_column].get<>();
+
+                for (size_t i = 0; i < trainers.size(); i++)
+                    models[i] = &trainers[i].model(label);
+
+                encoder.for_each_context(text, orders, [&models](const size_t &i, const uint64_t &context, const uint8_t &symbol) {
+                    models[i]->increment(context, symbol);
+                });
+            }
+        }
+
+        void train(const PackedCorpus& corpus) {
+            vector<FiniteContextModel*> models(trainers.size());
+
+            corpus.for_each([this, &models](const string& label, const uint8_t* symbols, const size_t& size) {
+                for (size_t i = 0; i < trainers.size(); i++)
+                    models[i] = &trainers[i].model(label);
+
+                encoder.for_each_context(symbols, size, orders, [&models](const size_t &i, const uint64_t &context, const uint8_t &symbol) {
+                    models[i]->increment(context, symbol);
+                });
+            });
+        }
+
+        // Saves the model of each label and order as label_order.bin.
+        void save(const ModelFormat& format = ModelFormat::STANDARD) {
+            for (FiniteContextModelTrainer& trainer: trainers) {
+                unordered_map<string, string> filenames;
+                for (const auto& [label, _]: trainer.models)
+                    filenames[label] = label + "_" + to_string(trainer.k) + ".bin";
+
+                trainer.save(filenames, format);
+            }
+        }
+};
+
+#endif // MULTI_ORDER_TRAINER_HPP_
@@ -0,0 +1,242 @@
+#ifndef PACKED_CORPUS_HPP_
+#define PACKED_CORPUS_HPP_
+
+#include <iostream>
+#include <fstream>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "context_encoder.hpp"
+#include "file_publishing.hpp"
+#include "csv.hpp"
+
+using namespace std;
+using namespace csv;
+
+const char CORPUS_FILE_MAGIC[8] = {'F', 'C', 'C', 'O', 'R', 'P', 'U', 'S'};
+const uint8_t CORPUS_FILE_VERSION = 1;
+
+// Dataset already split into rows and mapped to the symbol ids of one alphabet and case handling,
+// so that it can be trained on and evaluated repeatedly without parsing. The file holds a Header,
+// the sorted alphabet, then one record per row: a uint32 label id, a uint32 length and that many
+// symbol ids, one byte each. The label names follow the records. It is memory-mapped and the
+// symbol ids are handed out in place.
+class PackedCorpus {
+    public:
+        struct Header {
+            char magic[sizeof(CORPUS_FILE_MAGIC)];
+            uint8_t version;
+            uint8_t ignore_case;
+            uint16_t reserved;
+            uint32_t alphabet_size;
+            uint64_t rows;
+            uint64_t labels_offset;
+        };
+
+        string alphabet;
+        bool ignore_case;
+        vector<string> labels;
+        uint64_t rows;
+
+        PackedCorpus(const string &input_file) {
+            int descriptor = ::open(input_file.c_str(), O_RDONLY);
+
+            struct stat status;
+            if (descriptor < 0 || fstat(descriptor, &status) != 0 || static_cast<uint64_t>(status.st_size) < sizeof(Header)) {
+                cerr << "Error: cannot map " << input_file << "." << endl;
+                exit(EXIT_FAILURE);
+            }
+
+            void *address = mmap(nullptr, status.st_size, PROT_READ, MAP_SHARED, descriptor, 0);
+            ::close(descriptor);
+
+            if (address == MAP_FAILED) {
+                cerr << "Error: cannot map " << input_file << "." << endl;
+                exit(EXIT_FAILURE);
+            }
+
+            madvise(address, status.st_size, MADV_SEQUENTIAL);
+            mapping = shared_ptr<void>(address, [size = status.st_size](void *address) { munmap(address, size); });
+
+            const char *data = static_cast<const char*>(address);
+            const Header *header = reinterpret_cast<const Header*>(data);
+
+            if (memcmp(header->magic, CORPUS_FILE_MAGIC, sizeof(CORPUS_FILE_MAGIC)) != 0 || header->version > CORPUS_FILE_VERSION) {
+                cerr << "Error: " << input_file << " is not a packed corpus supported by this version." << endl;
+                exit(EXIT_FAILURE);
+            }
+
+            // A truncated or half-written file must fail here rather than fault while training.
+            uint64_t file_size = status.st_size;
+            uint64_t records_offset = sizeof(Header) + header->alphabet_size;
+            if (header->alphabet_size == 0 || header->alphabet_size > 256 || header->labels_offset < records_offset || header->labels_offset > file_size) {
+                cerr << "Error: cannot map " << input_file << "." << endl;
+                exit(EXIT_FAILURE);
+            }
+
+            ignore_case = header->ignore_case;
+            rows = header->rows;
+            alphabet.assign(data + sizeof(Header), header->alphabet_size);
+            records = data + records_offset;
+
+            const char *label = data + header->labels_offset;
+            const char *end = data + file_size;
+            while (label < end) {
+                uint32_t label_size;
+                if (static_cast<uint64_t>(end - label) < sizeof(label_size)) {
+                    cerr << "Error: cannot map " << input_file << "." << endl;
+                    exit(EXIT_FAILURE);
+                }
+
+                memcpy(&label_size, label, sizeof(label_size));
+                label += sizeof(label_size);
+
+                if (static_cast<uint64_t>(end - label) < label_size) {
+                    cerr << "Error: cannot map " << input_file << "." << endl;
+                    exit(EXIT_FAILURE);
+                }
+
+                labels.emplace_back(label, label_size);
+                label += label_size;
+            }
+
+            if (!valid_records(data + header->labels_offset)) {
+                cerr << "Error: cannot map " << input_file << "." << endl;
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        static bool is_packed(const string &input_file) {
+            ifstream input(input_file, ios::binary);
+
+            char magic[sizeof(CORPUS_FILE_MAGIC)];
+            return input.read(magic, sizeof(magic)) && memcmp(magic, CORPUS_FILE_MAGIC, sizeof(magic)) == 0;
+        }
+
+        // Whether the symbol ids are those the encoder maps text to.
+        bool compatible(const ContextEncoder &encoder) const {
+            return alphabet == encoder.alphabet && ignore_case == encoder.ignore_case;
+        }
+
+        // Calls f(label, symbols, size) for every row, in the order they were packed.
+        template <typename F>
+        void for_each(F f) const {
+            const char *record = records;
+
+            for (uint64_t i = 0; i < rows; i++) {
+                uint32_t label, size;
+                memcpy(&label, record, sizeof(label));
+                memcpy(&size, record + sizeof(label), sizeof(size));
+
+                const uint8_t *symbols = reinterpret_cast<const uint8_t*>(record + sizeof(label) + sizeof(size));
+                f(labels[label], symbols, static_cast<size_t>(size));
+
+                record += sizeof(label) + sizeof(size) + size;
+            }
+        }
+
+        // Packs the rows of the CSV input files into output_file with the symbol ids of encoder.
+        // The file is written next to output_file and renamed over it once complete, as models are.
+        static void write(const vector<string> &input_files, const string &text_column, const string &label_column, const ContextEncoder &encoder, const string &output_path) {
+            string output_file = resolve_path(output_path);
+            string temporary_file = create_temporary(output_file);
+            ofstream output(temporary_file, ios::binary);
+
+            Header header = {};
+            memcpy(header.magic, CORPUS_FILE_MAGIC, sizeof(CORPUS_FILE_MAGIC));
+            header.version = CORPUS_FILE_VERSION;
+            header.ignore_case = encoder.ignore_case;
+            header.alphabet_size = encoder.alphabet.size();
+
+            output.write((char*)&header, sizeof(header));
+            output.write(encoder.alphabet.data(), encoder.alphabet.size());
+
+            vector<string> names;
+            unordered_map<string, uint32_t> label_ids;
+
+            for (const string &input_file : input_files) {
+                CSVReader reader(input_file);
+
+                for (CSVRow &row : reader) {
+                    string label = row[label_column].get<>();
+
+                    auto it = label_ids.find(label);
+                    if (it == label_ids.end()) {
+                        it = label_ids.emplace(label, names.size()).first;
+                        names.push_back(label);
+                    }
+
+                    vector<uint8_t> symbols = encoder.encode(row[text_column].get<>());
+                    uint32_t size = symbols.size();
+
+                    output.write((char*)&it->second, sizeof(it->second));
+                    output.write((char*)&size, sizeof(size));
+                    output.write((char*)symbols.data(), symbols.size());
+
+                    header.rows++;
+                }
+            }
+
+            header.labels_offset = output.tellp();
+
+            for (const string &name : names) {
+                uint32_t size = name.size();
+                output.write((char*)&size, sizeof(size));
+                output.write(name.data(), name.size());
+            }
+
+            output.seekp(0);
+            output.write((char*)&header, sizeof(header));
+            output.close();
+
+            if (output.fail()) {
+                unlink(temporary_file.c_str());
+                cerr << "Error: cannot write " << output_file << "." << endl;
+                exit(EXIT_FAILURE);
+            }
+
+            publish(temporary_file, output_file);
+        }
+
+    private:
+        const char *records;
+        shared_ptr<void> mapping;
+
+        // Whether the rows records end exactly at end, each with a known label and symbol ids
+        // within the alphabet.
+        bool valid_records(const char *end) const {
+            const char *record = records;
+
+            for (uint64_t i = 0; i < rows; i++) {
+                uint32_t label, size;
+                if (static_cast<uint64_t>(end - record) < sizeof(label) + sizeof(size))
+                    return false;
+
+                memcpy(&label, record, sizeof(label));
+                memcpy(&size, record + sizeof(label), sizeof(size));
+                record += sizeof(label) + sizeof(size);
+
+                if (label >= labels.size() || static_cast<uint64_t>(end - record) < size)
+                    return false;
+
+                const uint8_t *symbols = reinterpret_cast<const uint8_t*>(record);
+                if (size > 0 && *max_element(symbols, symbols + size) >= alphabet.size())
+                    return false;
+
+                record += size;
+            }
+
+            return record == end;
+        }
+};
+
+#endif // PACKED_CORPUS_HPP_
@@ -0,0 +1,76 @@
+#ifndef SPSC_QUEUE_HPP_
+#define SPSC_QUEUE_HPP_
+
+#include <atomic>
+#include <vector>
+#include <thread>
+
+#include "event_count.hpp"
+
+using namespace std;
+
+// Attempts, yielding the processor in between, before a blocked thread goes to sleep.
+const size_t SPINS_BEFORE_WAIT = 64;
+
+// Lock-free ring buffer between exactly one producer and one consumer thread. The producer owns
+// tail and the consumer owns head; each only reads the other's index, so no locks are needed.
+template <typename T>
+class SpscQueue {
+    private:
+        vector<T> slots;
+        size_t mask;
+        alignas(64) atomic<size_t> head;
+        alignas(64) atomic<size_t> tail;
+        EventCount space;
+
+    public:
+        // capacity is rounded up to a power of two.
+        SpscQueue(const size_t &capacity): head(0), tail(0) {
+            size_t size = 1;
+            while (size < capacity)
+                size <<= 1;
+
+            slots.resize(size);
+            mask = size - 1;
+        }
+
+        bool try_push(T &item) {
+            size_t position = tail.load(memory_order_relaxed);
+            if (position - head.load(memory_order_acquire) == slots.size())
+                return false;
+
+            slots[position & mask] = move(item);
+            tail.store(position + 1, memory_order_release);
+
+            return true;
+        }
+
+        // Spins, yielding the processor, until the consumer makes room, and sleeps until it pops
+        // an item if that takes more than SPINS_BEFORE_WAIT attempts.
+        void push(T item) {
+            for (size_t attempts = 1; ; attempts++) {
+                uint64_t key = space.prepare();
+                if (try_push(item))
+                    return;
+
+                if (attempts < SPINS_BEFORE_WAIT)
+                    this_thread::yield();
+                else
+                    space.wait(key);
+            }
+        }
+
+        bool try_pop(T &item) {
+            size_t position = head.load(memory_order_relaxed);
+            if (position == tail.load(memory_order_acquire))
+                return false;
+
+            item = move(slots[position & mask]);
+            head.store(position + 1, memory_order_release);
+            space.notify();
+
+            return true;
+        }
+};
+
+#endif // SPSC_QUEUE_HPP_
@@ -0,0 +1,347 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <iomanip>
+#include <chrono>
+#include <sstream>
+#include <thread>
+#include <atomic>
+
+#include "finite_context_model_trainer.hpp"
+#include "finite_context_model_evaluator.hpp"
+
+using namespace std;
+using namespace chrono;
+
+// Documents of a CSV file held in memory for the whole sweep.
+struct Corpus {
+    vector<string> texts;
+    vector<string> labels;
+
+    Corpus() {}
+
+    Corpus(const string& input_file) {
+        CSVReader reader(input_file);
+
+        for (CSVRow& row: reader) {
+            texts.push_back(row["text"].get<>());
+            labels.push_back(row["label"].get<>());
+        }
+    }
+
+    vector<vector<uint8_t>> encode(const ContextEncoder& encoder) const {
+        vector<vector<uint8_t>> documents;
+        documents.reserve(texts.size());
+
+        for (const string& text: texts)
+            documents.push_back(encoder.encode(text));
+
+        return documents;
+    }
+};
+
+// Train and test documents mapped to the symbol ids of one alphabet and case handling.
+struct Setting {
+    string alphabet;
+    bool ignore_case;
+    vector<vector<uint8_t>> train;
+    vector<vector<uint8_t>> test;
+};
+
+// Models of one order trained for a setting and evaluated under every smoothing factor.
+struct GridPoint {
+    const Setting* setting;
+    size_t k;
+    double size;
+    double training_time;
+    vector<FiniteContextModelEvaluator> results;
+};
+
+size_t saved_size(const unordered_map<string, FiniteContextModel>& models) {
+    size_t size = 0;
+    for (const auto& [_, model]: models)
+        size += model.saved_size();
+    return size;
+}
+
+// Trains the models of a grid point on the training documents and evaluates them on the test ones.
+void evaluate(GridPoint& point, const Corpus& train_corpus, const Corpus& test_corpus, const vector<float>& smoothing_factors, const uint8_t& scaling_factor) {
+    const Setting& setting = *point.setting;
+
+    auto start_training = high_resolution_clock::now();
+
+    FiniteContextModelTrainer trainer(point.k, smoothing_factors[0], setting.alphabet, setting.ignore_case, scaling_factor);
+    for (size_t d = 0; d < setting.train.size(); d++)
+        trainer.model(train_corpus.labels[d]).update(setting.train[d]);
+
+    auto end_training = high_resolution_clock::now();
+
+    point.training_time = duration_cast<duration<double>>(end_training - start_training).count();
+    point.size = saved_size(trainer.models) / 1e6;
+
+    FiniteContextModelEvaluator evaluator(move(trainer.models));
+    evaluator.sweep(setting.test, test_corpus.labels, smoothing_factors, point.results);
+}
+
+// Cross-validates the models of a grid point over the training documents, document d being held
+// out in fold d % folds. The documents are counted once into the models of their fold, which are
+// summed into the full models; each fold is then scored against the full counts minus its own, so
+// the cost is about one training and one scoring pass whatever the number of folds.
+void cross_validate(GridPoint& point, const Corpus& corpus, const size_t& folds, const vector<float>& smoothing_factors, const uint8_t& scaling_factor) {
+    const Setting& setting = *point.setting;
+
+    auto start_training = high_resolution_clock::now();
+
+    vector<FiniteContextModelTrainer> fold_trainers;
+    for (size_t f = 0; f < folds; f++)
+        fold_trainers.emplace_back(point.k, smoothing_factors[0], setting.alphabet, setting.ignore_case, scaling_factor);
+
+    vector<size_t> document_folds(setting.train.size());
+    for (size_t d = 0; d < setting.train.size(); d++) {
+        document_folds[d] = d % folds;
+        fold_trainers[d % folds].model(corpus.labels[d]).update(setting.train[d]);
+    }
+
+    unordered_map<string, FiniteContextModel> models;
+    for (FiniteContextModelTrainer& trainer: fold_trainers) {
+        for (const auto& [label, model]: trainer.models) {
+            auto it = models.find(label);
+            if (it == models.end())
+                models.emplace(label, model);
+            else
+                it->second.merge(model);
+        }
+    }
+
+    // Every label needs a model in every fold to be subtracted, even one without documents there.
+    vector<unordered_map<string, FiniteContextModel>> fold_models;
+    for (FiniteContextModelTrainer& trainer: fold_trainers) {
+        for (const auto& [label, _]: models)
+            trainer.model(label);
+        fold_models.push_back(move(trainer.models));
+    }
+
+    auto end_training = high_resolution_clock::now();
+
+    point.training_time = duration_cast<duration<double>>(end_training - start_training).count();
+    point.size = saved_size(models) / 1e6;
+
+    FiniteContextModelEvaluator evaluator(move(models));
+    evaluator.sweep(setting.train, corpus.labels, document_folds, fold_models, smoothing_factors, point.results);
+}
+
+void print_usage(const char *argv0) {
+    cout << "Usage: " << argv0 << " [-k orders] [-s smoothing_factors] [-a alphabet]+ [-c case] (train_file test_file | -v folds input_file)" << endl;
+    cout << endl;
+    cout << "Train and evaluate the models of every combination of order, smoothing factor, alphabet and case handling" << endl;
+    cout << "in one process, writing a row per combination with the size of the models in MB, the training time and" << endl;
+    cout << "the accuracy. Both files are read once; the models of each order are trained once and evaluated under" << endl;
+    cout << "every smoothing factor in a single pass." << endl;
+    cout << "With -v the accuracy is cross-validated over one input file instead, each fold scored against" << endl;
+    cout << "the counts of all the data minus its own." << endl;
+    cout << endl;
+    cout << "Options:" << endl;
+    cout << "  -k orders\t\t\tOrder or range of orders such as 1-9. (default: 1-5)" << endl;
+    cout << "  -s smoothing_factors\t\tComma-separated smoothing factors. (default: 0.5,0.75,1,1.25,1.5)" << endl;
+    cout << "  -a alphabet\t\t\tAlphabet, may be given several times. (default: abc...ABC...012...)" << endl;
+    cout << "  -c case\t\t\tCase handling: sensitive, insensitive or both. (default: sensitive)" << endl;
+    cout << "  -v folds\t\t\tNumber of cross-validation folds, every folds-th row of the input file in the same fold." << endl;
+    cout << "  -r scaling_factor\t\tScaling factor for when the counts reach UINT32_MAX. (default: 2)" << endl;
+    cout << "  -j threads\t\t\tNumber of orders trained and evaluated at the same time. (default: number of processors)" << endl;
+    cout << "  -o output_file\t\tTab-separated results, with alphabet and case columns when several are swept. (default: output.txt)" << endl;
+    cout << "  -h\t\t\t\tDisplay this help message" << endl;
+    cout << endl;
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+
+    size_t min_k = 1;
+    size_t max_k = 5;
+    vector<float> smoothing_factors;
+    vector<string> alphabets;
+    vector<bool> cases = {false};
+    uint8_t scaling_factor = 2;
+    int threads = max(1u, thread::hardware_concurrency());
+    string output_file = "output.txt";
+    size_t folds = 0;
+
+    while ((opt = getopt(argc, argv, "k:s:a:c:v:r:j:o:h")) != -1) {
+        switch (opt) {
+            case 'k': {
+                string orders = optarg;
+                size_t dash = orders.find('-');
+                int first = stoi(orders.substr(0, dash));
+                int last = dash == string::npos ? first : stoi(orders.substr(dash + 1));
+                if (first < 1 || last < first) {
+                    cerr << "Order must be at least 1" << endl;
+                    exit(EXIT_FAILURE);
+                }
+                min_k = first;
+                max_k = last;
+                break;
+            }
+            case 's': {
+                stringstream factors(optarg);
+                string factor;
+                while (getline(factors, factor, ','))
+                    smoothing_factors.push_back(stof(factor));
+                break;
+            }
+            case 'a':
+                alphabets.push_back(optarg);
+                if (alphabets.back().empty()) {
+                    cerr << "Alphabet cannot be empty" << endl;
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'c':
+                if (string(optarg) == "sensitive")
+                    cases = {false};
+                else if (string(optarg) == "insensitive")
+                    cases = {true};
+                else if (string(optarg) == "both")
+                    cases = {false, true};
+                else {
+                    cerr << "Unknown case handling: " << optarg << endl;
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'v':
+                if (stoi(optarg) < 2) {
+                    cerr << "The number of folds must be at least 2" << endl;
+                    exit(EXIT_FAILURE);
+                }
+                folds = stoi(optarg);
+                break;
+            case 'r':
+                scaling_factor = stoi(optarg);
+                if (scaling_factor < 1) {
+                    cerr << "Scaling factor must be at least 1" << endl;
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'j':
+                threads = stoi(optarg);
+                if (threads < 1) {
+                    cerr << "The number of threads must be at least 1" << endl;
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'o':
+                output_file = optarg;
+                break;
+            case 'h':
+                printf("Help\n");
+                print_usage(argv[0]);
+                exit(EXIT_SUCCESS);
+            case '?':
+                printf("Unknown option: %c\n", optopt);
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            case ':':
+                printf("Missing argument for option: %c\n", optopt);
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            default:
+                printf("Error parsing arguments\n");
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (smoothing_factors.empty())
+        smoothing_factors = {0.5, 0.75, 1, 1.25, 1.5};
+
+    if (alphabets.empty())
+        alphabets.push_back("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789");
+
+    if (folds == 0 && argc - optind != 2)
+    {
+        cerr << "A train file and a test file must be provided" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    if (folds > 0 && argc - optind != 1)
+    {
+        cerr << "Cross-validation takes a single input file" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    auto start_loading = high_resolution_clock::now();
+
+    Corpus train_corpus(argv[optind]);
+    Corpus test_corpus = folds > 0 ? Corpus() : Corpus(argv[optind + 1]);
+
+    vector<Setting> settings;
+
+    for (const string& alphabet: alphabets) {
+        for (bool ignore_case: cases) {
+            ContextEncoder encoder(1, alphabet, ignore_case);
+
+            if (max_k > FiniteContextModel::max_order(encoder.alphabet_size()))
+            {
+                cerr << "Order must be at most " << FiniteContextModel::max_order(encoder.alphabet_size()) << " for an alphabet of " << encoder.alphabet_size() << " symbols" << endl;
+                exit(EXIT_FAILURE);
+            }
+
+            settings.push_back({alphabet, ignore_case, train_corpus.encode(encoder), test_corpus.encode(encoder)});
+        }
+    }
+
+    auto end_loading = high_resolution_clock::now();
+
+    cout << "Loading time: " << fixed << setprecision(6) << duration_cast<duration<double>>(end_loading - start_loading).count() << "s" << endl;
+
+    // Highest orders first, as they take longest, so that no thread is left with one at the end.
+    vector<GridPoint> grid;
+    for (size_t k = max_k; k >= min_k; k--)
+        for (const Setting& setting: settings)
+            grid.push_back({&setting, k, 0, 0, {}});
+
+    auto start_sweep = high_resolution_clock::now();
+
+    atomic<size_t> next(0);
+    vector<thread> workers;
+
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&grid, &next, &smoothing_factors, &test_corpus, &train_corpus, folds, scaling_factor]() {
+            for (size_t i = next++; i < grid.size(); i = next++) {
+                GridPoint& point = grid[i];
+                if (folds > 0)
+                    cross_validate(point, train_corpus, folds, smoothing_factors, scaling_factor);
+                else
+                    evaluate(point, train_corpus, test_corpus, smoothing_factors, scaling_factor);
+            }
+        });
+    }
+
+    for (thread& worker: workers)
+        worker.join();
+
+    auto end_sweep = high_resolution_clock::now();
+
+    cout << "Sweep time: " << fixed << setprecision(6) << duration_cast<duration<double>>(end_sweep - start_sweep).count() << "s" << endl;
+
+    bool several_settings = settings.size() > 1;
+
+    ofstream output(output_file);
+    output << "k\ts\tsize\tTrainingTime\tAccuracy" << (several_settings ? "\tIgnoreCase\tAlphabet" : "") << "\n";
+
+    for (size_t k = min_k; k <= max_k; k++) {
+        for (GridPoint& point: grid) {
+            if (point.k != k)
+                continue;
+
+            for (size_t s = 0; s < smoothing_factors.size(); s++) {
+                output << k << "\t" << smoothing_factors[s] << "\t" << point.size << "\t" << point.training_time << "\t" << point.results[s].accuracy();
+                if (several_settings)
+                    output << "\t" << point.setting->ignore_case << "\t" << point.setting->alphabet;
+                output << "\n";
+            }
+        }
+    }
+
+    output.close();
+}
@@ -3,8 +3,10 @@
 #include <string>
 #include <iomanip>
 #include <chrono>
+#include <unordered_set>
 
 #include "finite_context_model_trainer.hpp"
+#include "multi_order_trainer.hpp"
 
 using namespace std;
 using namespace chrono;
@@ -12,14 +14,20 @@ using namespace chrono;
 void print_usage(const char *argv0) {
     cout << "Usage: " << argv0 << " [-n num_labels] [-k order] [-s smoothing_factor] [-a alphabet] input_file+" << endl;
     cout << endl;
-    cout << "Run the Trainer on the input file." << endl;
+    cout << "Run the Trainer on the input file, a CSV file or a corpus packed by corpus_pack with the same -a and -i." << endl;
     cout << endl;
     cout << "Options:" << endl;
-    cout << "  -k order\t\t\tOrder for the Finite Context Model. (default: 5)" << endl;
+    cout << "  -k order\t\t\tOrder for the Finite Context Model, or a range such as 1-9 to train every order in one pass," << endl;
+    cout << "\t\t\t\tsaving label_order.bin files. (default: 5)" << endl;
     cout << "  -s smoothing_factor\t\tSmoothing factor for the Finite Context Model. (default: 1)" << endl;
     cout << "  -a alphabet\t\t\tAlphabet for the Finite Context Model. (default: abc...ABC...012...)" << endl;
     cout << "  -i\t\t\t\tIgnore case when training the model. The alphabet will be converted to uppercase. (default: false)" << endl;
     cout << "  -r scaling_factor\t\tScaling factor for when the counts reach UINT32_MAX. (default: 2)" << endl;
+    cout << "  -b backend\t\t\tCount table backend: hash, flat, or dense for low orders. (default: hash)" << endl;
+    cout << "  -j threads\t\t\tNumber of threads counting the rows of the input files. (default: 1)" << endl;
+    cout << "  -p shards\t\t\tPartition the contexts by hash among this many threads, each owning its counts, fed by the -j threads. (not for the dense backend)" << endl;
+    cout << "  -f format\t\t\tModel file format: standard, mapped for read-only models used in place without parsing, or compact for small files. (default: standard)" << endl;
+    cout << "  -w model_file\t\t\tExisting model to continue training, one per label. It must match -k, -a, -i and -s." << endl;
     cout << "  -h\t\t\t\tDisplay this help message" << endl;
     cout << endl;
 };
@@ -29,20 +37,32 @@ int main(int argc, char *argv[]) {
     int opt;
     
     size_t k = 5;
+    size_t min_k = 5;
     float smoothing_factor = 1;
     string alphabet = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
     bool ignore_case = false;
     uint8_t scaling_factor = 2;
+    ContextStorage storage = ContextStorage::HASH;
+    int threads = 1;
+    int shards = 0;
+    vector<string> model_files;
+    ModelFormat format = ModelFormat::STANDARD;
 
-    while ((opt = getopt(argc, argv, "k:s:a:r:ich")) != -1) {
+    while ((opt = getopt(argc, argv, "k:s:a:r:b:j:p:w:f:ich")) != -1) {
         switch (opt) {
-            case 'k':
-                k = stoi(optarg);
-                if (k < 1) {
+            case 'k': {
+                string orders = optarg;
+                size_t dash = orders.find('-');
+                int first = stoi(orders.substr(0, dash));
+                int last = dash == string::npos ? first : stoi(orders.substr(dash + 1));
+                if (first < 1 || last < first) {
                     cerr << "Order must be at least 1" << endl;
                     exit(EXIT_FAILURE);
                 }
+                min_k = first;
+                k = last;
                 break;
+            }
             case 's':
                 smoothing_factor = stof(optarg);
                 break;
@@ -60,6 +80,47 @@ int main(int argc, char *argv[]) {
                     exit(EXIT_FAILURE);
                 }
                 break;
+            case 'j':
+                threads = stoi(optarg);
+                if (threads < 1) {
+                    cerr << "The number of threads must be at least 1" << endl;
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'p':
+                shards = stoi(optarg);
+                if (shards < 1) {
+                    cerr << "The number of shards must be at least 1" << endl;
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'f':
+                if (string(optarg) == "standard")
+                    format = ModelFormat::STANDARD;
+                else if (string(optarg) == "mapped")
+                    format = ModelFormat::MAPPED;
+                else if (string(optarg) == "compact")
+                    format = ModelFormat::COMPACT;
+                else {
+                    cerr << "Unknown format: " << optarg << endl;
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'w':
+                model_files.push_back(optarg);
+                break;
+            case 'b':
+                if (string(optarg) == "hash")
+                    storage = ContextStorage::HASH;
+                else if (string(optarg) == "flat")
+                    storage = ContextStorage::FLAT;
+                else if (string(optarg) == "dense")
+                    storage = ContextStorage::DENSE;
+                else {
+                    cerr << "Unknown backend: " << optarg << endl;
+                    exit(EXIT_FAILURE);
+                }
+                break;
             case 'i':
                 ignore_case = true;
                 break;
@@ -82,6 +143,34 @@ int main(int argc, char *argv[]) {
         }
     }
     
+    unordered_set<char> symbols;
+    for (char c : alphabet)
+        symbols.insert(ignore_case ? toupper(c) : c);
+
+    if (k > FiniteContextModel::max_order(symbols.size()))
+    {
+        cerr << "Order must be at most " << FiniteContextModel::max_order(symbols.size()) << " for an alphabet of " << symbols.size() << " symbols" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    if (storage == ContextStorage::DENSE && k > FiniteContextModel::max_dense_order(symbols.size()))
+    {
+        cerr << "Order must be at most " << FiniteContextModel::max_dense_order(symbols.size()) << " for a dense backend with an alphabet of " << symbols.size() << " symbols" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    if (shards > 0 && storage == ContextStorage::DENSE)
+    {
+        cerr << "The dense backend cannot be partitioned into shards" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    if (min_k < k && (threads > 1 || shards > 0 || !model_files.empty()))
+    {
+        cerr << "A range of orders cannot be combined with -j, -p or -w" << endl;
+        exit(EXIT_FAILURE);
+    }
+
     if (optind >= argc)
     {
         cerr << "Input file not provided" << endl;
@@ -89,12 +178,55 @@ int main(int argc, char *argv[]) {
     }
 
     vector<string> input_files(argv + optind, argv + argc);
-    FiniteContextModelTrainer trainer(k, smoothing_factor, alphabet, ignore_case, scaling_factor);
+
+    for (const string& input_file: input_files) {
+        if (!PackedCorpus::is_packed(input_file))
+            continue;
+
+        if (threads > 1 || shards > 0)
+        {
+            cerr << "Packed corpora cannot be combined with -j or -p" << endl;
+            exit(EXIT_FAILURE);
+        }
+
+        if (!PackedCorpus(input_file).compatible(ContextEncoder(k, alphabet, ignore_case)))
+        {
+            cerr << input_file << " was not packed with the given alphabet and case handling" << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    FiniteContextModelTrainer trainer(k, smoothing_factor, alphabet, ignore_case, scaling_factor, storage);
+
+    vector<size_t> orders;
+    for (size_t order = min_k; order <= k; order++)
+        orders.push_back(order);
+
+    MultiOrderTrainer multi_order_trainer(orders, smoothing_factor, alphabet, ignore_case, scaling_factor, storage);
+
+    for (const string& model_file: model_files) {
+        if (!trainer.resume(FiniteContextModel(model_file)))
+        {
+            cerr << model_file << " was not trained with the given order, alphabet, case handling and smoothing factor" << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
 
     auto start_training = high_resolution_clock::now();
 
-    for (string input_file: input_files)
-        trainer.train(input_file, "text", "label");
+    for (string input_file: input_files) {
+        if (PackedCorpus::is_packed(input_file) && orders.size() > 1)
+            multi_order_trainer.train(PackedCorpus(input_file));
+        else if (PackedCorpus::is_packed(input_file))
+            trainer.train(PackedCorpus(input_file));
+        else if (orders.size() > 1)
+            multi_order_trainer.train(input_file, "text", "label");
+        else if (shards > 0)
+            trainer.train_partitioned(input_file, "text", "label", static_cast<size_t>(threads), static_cast<size_t>(shards));
+        else if (threads > 1)
+            trainer.train(input_file, "text", "label", static_cast<size_t>(threads));
+        else
+            trainer.train(input_file, "text", "label");
+    }
 
     auto end_training = high_resolution_clock::now();
 
@@ -102,7 +234,10 @@ int main(int argc, char *argv[]) {
 
     auto start_saving = high_resolution_clock::now();
 
-    trainer.save();
+    if (orders.size() > 1)
+        multi_order_trainer.save(format);
+    else
+        trainer.save(format);
 
     auto end_saving = high_resolution_clock::now();
     
@@ -0,0 +1,40 @@
+#ifndef VARINT_HPP_
+#define VARINT_HPP_
+
+#include <string>
+#include <cstdint>
+
+using namespace std;
+
+// LEB128 variable-length integers: seven bits per byte, least significant group first, with the
+// high bit set on every byte but the last. Counts below 128 take a single byte.
+inline void put_varint(string &buffer, uint64_t value) {
+    while (value >= 0x80) {
+        buffer.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    buffer.push_back(static_cast<char>(value));
+}
+
+// Reads a varint at position, advancing it. Stops at end on truncated input.
+inline uint64_t get_varint(const char *&position, const char *end) {
+    uint64_t value = 0;
+    for (int shift = 0; position != end && shift < 64; shift += 7) {
+        uint8_t byte = static_cast<uint8_t>(*position++);
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+            break;
+    }
+    return value;
+}
+
+// Maps signed values to unsigned ones so that small magnitudes of either sign stay short.
+inline uint64_t zigzag(const int64_t &value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t unzigzag(const uint64_t &value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+#endif // VARINT_HPP_
@@ -3,20 +3,28 @@
 #include <string>
 #include <iomanip>
 #include <chrono>
+#include <thread>
+#include <getopt.h>
 
 #include "finite_context_model_evaluator.hpp"
+#include "finite_context_model_server.hpp"
 
 using namespace std;
 using namespace chrono;
 
 void print_usage(const char *argv0) {
-    cout << "Usage: " << argv0 << " [-m model_file+] input_file+" << endl;
+    cout << "Usage: " << argv0 << " [-m model_file+ | -l ratio_file] (input_file+ | --serve socket_path)" << endl;
     cout << endl;
     cout << "Run the was_chatted program on the input file(s) using the model file(s)." << endl;
     cout << endl;
     cout << "Options:" << endl;
     cout << "  -m model_file+\t\tModel file(s) to use for prediction" << endl;
     cout << "  -u\t\t\t\tUpdate the counts of the model while evaluating." << endl;
+    cout << "  -f\t\t\t\tFuse the models into one multi-label table scored in a single pass. (cannot be combined with -u)" << endl;
+    cout << "  -l ratio_file\t\t\tLog ratio table exported from two models, used instead of the model files. Bits are reported relative to the second label." << endl;
+    cout << "  --serve socket_path\t\tLoad the models once and answer requests on a Unix domain socket: a uint32 length followed by the text," << endl;
+    cout << "\t\t\t\tanswered with a uint32 length followed by the predicted label and one \"label<TAB>bits\" line per label. (cannot be combined with -u)" << endl;
+    cout << "  -j threads\t\t\tNumber of threads serving connections. (default: number of processors)" << endl;
     cout << "  -h\t\t\t\tDisplay this help message" << endl;
     cout << endl;
 }
@@ -26,8 +34,17 @@ int main(int argc, char *argv[]) {
 
     vector<string> model_files;
     bool update = false;
+    bool fuse = false;
+    string ratio_file;
+    string socket_path;
+    int threads = max(1u, thread::hardware_concurrency());
 
-    while ((opt = getopt(argc, argv, "m:uh")) != -1) {
+    const option long_options[] = {
+        {"serve", required_argument, nullptr, 'S'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    while ((opt = getopt_long(argc, argv, "m:ufl:j:h", long_options, nullptr)) != -1) {
         switch (opt) {
             case 'm':
                 model_files.push_back(optarg);
@@ -35,6 +52,22 @@ int main(int argc, char *argv[]) {
             case 'u':
                 update = true;
                 break;
+            case 'f':
+                fuse = true;
+                break;
+            case 'l':
+                ratio_file = optarg;
+                break;
+            case 'S':
+                socket_path = optarg;
+                break;
+            case 'j':
+                threads = stoi(optarg);
+                if (threads < 1) {
+                    cerr << "The number of threads must be at least 1" << endl;
+                    exit(EXIT_FAILURE);
+                }
+                break;
             case 'h':
                 printf("Help\n");
                 print_usage(argv[0]);
@@ -54,13 +87,31 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    if (model_files.size() < 2)
+    if (ratio_file.empty() && model_files.size() < 2)
     {
         cerr << "At least two model files must be provided" << endl;
         exit(EXIT_FAILURE);
     }
 
-    if (optind >= argc)
+    if (fuse && update)
+    {
+        cerr << "Fused models cannot be updated" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    if (!ratio_file.empty() && (update || fuse || !model_files.empty()))
+    {
+        cerr << "A log ratio table cannot be combined with model files, -u or -f" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    if (!socket_path.empty() && update)
+    {
+        cerr << "Models cannot be updated while serving" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    if (socket_path.empty() && optind >= argc)
     {
         cerr << "Input file not provided" << endl;
         exit(EXIT_FAILURE);
@@ -70,12 +121,24 @@ int main(int argc, char *argv[]) {
 
     auto start_loading = high_resolution_clock::now();
 
-    FiniteContextModelEvaluator evaluator(model_files);
+    FiniteContextModelEvaluator evaluator = ratio_file.empty() ? FiniteContextModelEvaluator(model_files) : FiniteContextModelEvaluator(LogRatioTable(ratio_file));
+
+    if (fuse && !evaluator.fuse())
+    {
+        cerr << "Models must share the same order, alphabet and case handling to be fused" << endl;
+        exit(EXIT_FAILURE);
+    }
 
     auto end_loading = high_resolution_clock::now();
 
     cout << "Loading time: " << fixed << setprecision(6) << duration_cast<duration<double>>(end_loading - start_loading).count() << "s" << endl << endl;
 
+    if (!socket_path.empty())
+    {
+        cout << "Serving on " << socket_path << " with " << threads << " threads" << endl;
+        FiniteContextModelServer(evaluator, threads).listen(socket_path);
+    }
+
     auto start_predicting = high_resolution_clock::now();
 
     vector<Prediction> predictions;
@@ -0,0 +1,53 @@
+#ifndef WORK_QUEUE_HPP_
+#define WORK_QUEUE_HPP_
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+// Bounded blocking queue shared by any number of producers and consumers. push blocks while the
+// queue is full; pop blocks while it is empty and returns false once it is closed and drained.
+template <typename T>
+class WorkQueue {
+    private:
+        deque<T> items;
+        size_t capacity;
+        bool closed;
+        mutex lock;
+        condition_variable not_empty;
+        condition_variable not_full;
+
+    public:
+        WorkQueue(const size_t &capacity): capacity(capacity), closed(false) {}
+
+        void push(T item) {
+            unique_lock<mutex> guard(lock);
+            not_full.wait(guard, [this]() { return items.size() < capacity; });
+            items.push_back(move(item));
+            not_empty.notify_one();
+        }
+
+        bool pop(T &item) {
+            unique_lock<mutex> guard(lock);
+            not_empty.wait(guard, [this]() { return !items.empty() || closed; });
+
+            if (items.empty())
+                return false;
+
+            item = move(items.front());
+            items.pop_front();
+            not_full.notify_one();
+
+            return true;
+        }
+
+        void close() {
+            lock_guard<mutex> guard(lock);
+            closed = true;
+            not_empty.notify_all();
+        }
+};
+
+#endif // WORK_QUEUE_HPP_